@@ -0,0 +1,22 @@
+// node bench/mix-engine.js [frames] [iterations]
+// times plain SDL_mixer channel mixing against the float mix engine kernels
+
+var sdl_mixer = require('../node-sdl2_mixer.js').Mix();
+
+var frames = parseInt(process.argv[2], 10) || 1024;
+var iterations = parseInt(process.argv[3], 10) || 200;
+var rows = sdl_mixer.BenchmarkMixEngine({
+  voices: [ 8, 16, 32, 64, 128, 256, 512 ],
+  frames: frames,
+  iterations: iterations
+});
+
+console.log("frames " + frames + ", iterations " + iterations + ", AUDIO_S16SYS stereo");
+console.log("voices  stock ms  engine ms  speedup");
+rows.forEach(function(row) {
+  console.log(
+    ("      " + row.voices).slice(-6) + "  " +
+    ("        " + row.stockMs.toFixed(3)).slice(-8) + "  " +
+    ("         " + row.engineMs.toFixed(3)).slice(-9) + "  " +
+    ("       " + row.speedup.toFixed(2)).slice(-7) + "x");
+});
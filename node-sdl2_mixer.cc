@@ -26,13 +26,42 @@
 
 #include "node-sdl2_mixer.h"
 
+#include <math.h> // fabs, sqrt
+#include <stddef.h> // offsetof
 #include <stdlib.h> // malloc, free
-#include <string.h> // strdup
+#include <string.h> // strdup, strerror
+#include <errno.h> // errno
 
 #ifndef strdup
 #define strdup(str) strcpy((char*)malloc(strlen(str)+1),str)
 #endif
 
+#if defined(__linux__)
+#include <sched.h> // sched_setscheduler, sched_setaffinity
+#include <sys/mman.h> // mlock
+#include <sys/syscall.h> // SYS_gettid
+#include <unistd.h> // syscall
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MIX_AVX2 1
+#define MIX_AVX2_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MIX_AVX2 1 // built for the target, used when SDL_HasAVX2
+#define MIX_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIX_NEON 1
+#endif
+
 #if defined(__ANDROID__)
 #include <android/log.h>
 #define printf(...) __android_log_print(ANDROID_LOG_INFO, "printf", __VA_ARGS__)
@@ -40,139 +69,4099 @@
 
 #define countof(_a) (sizeof(_a)/sizeof((_a)[0]))
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 using namespace v8;
 
 namespace node_sdl2_mixer {
 
+// options object helpers
+
+static Local<Value> _option(Local<Value> options, const char* key)
+{
+	if (!options->IsObject()) { return Nan::Undefined(); }
+	return Local<Object>::Cast(options)->Get(NANX_SYMBOL(key));
+}
+
+static int _option_int(Local<Value> options, const char* key, int value)
+{
+	Local<Value> option = _option(options, key);
+	return (option->IsNumber())?(NANX_int(option)):(value);
+}
+
+static double _option_double(Local<Value> options, const char* key, double value)
+{
+	Local<Value> option = _option(options, key);
+	return (option->IsNumber())?(NANX_double(option)):(value);
+}
+
+static bool _option_bool(Local<Value> options, const char* key, bool value)
+{
+	Local<Value> option = _option(options, key);
+	return (option->IsUndefined() || option->IsNull())?(value):(option->BooleanValue());
+}
+
 // music finished callback
 
-static void _music_finished_set_callback(Local<Function> callback);
-static void _music_finished_callback(void);
+static void _music_finished_set_callback(Local<Function> callback);
+static void _music_finished_callback(void);
+
+static Nan::Persistent<Function> s_music_finished_callback;
+
+static void _music_finished_set_callback(Local<Function> callback)
+{
+	s_music_finished_callback.Reset();
+	if (!callback->IsNull())
+	{
+		s_music_finished_callback.Reset(callback);
+	}
+}
+
+class TaskMusicFinished : public Nanx::SimpleTask
+{
+public:
+	void DoWork() {}
+	void DoAfterWork(int status)
+	{
+		if (!s_music_finished_callback.IsEmpty())
+		{
+			Nan::HandleScope scope;
+			Mix_HookMusicFinished(NULL);
+			Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(s_music_finished_callback), 0, NULL);
+			Mix_HookMusicFinished(_music_finished_callback);
+		}
+	}
+};
+
+static void _music_finished_callback(void)
+{
+	int err = Nanx::SimpleTask::Run(new TaskMusicFinished());
+}
+
+static void _music_finished_init(void)
+{
+	Mix_HookMusicFinished(_music_finished_callback);
+}
+
+static void _music_finished_quit(void)
+{
+	Mix_HookMusicFinished(NULL);
+	s_music_finished_callback.Reset();
+}
+
+// channel finished callback
+
+static void _channel_finished_set_callback(Local<Function> callback);
+static void _channel_finished_callback(int channel);
+
+static Nan::Persistent<Function> s_channel_finished_callback;
+
+static void _channel_finished_set_callback(Local<Function> callback)
+{
+	s_channel_finished_callback.Reset();
+	if (!callback->IsNull())
+	{
+		s_channel_finished_callback.Reset(callback);
+	}
+}
+
+static void _channel_finished_init(void)
+{
+	Mix_ChannelFinished(_channel_finished_callback);
+}
+
+static void _channel_finished_quit(void)
+{
+	Mix_ChannelFinished(NULL);
+	s_channel_finished_callback.Reset();
+}
+
+// param is the envelope that completed, or -1 when the channel finished
+class TaskChannelFinished : public Nanx::SimpleTask
+{
+public:
+	int m_channel;
+	int m_param;
+public:
+	TaskChannelFinished(int channel, int param = -1) : m_channel(channel), m_param(param) {}
+	void DoWork() {}
+	void DoAfterWork(int status)
+	{
+		if (!s_channel_finished_callback.IsEmpty())
+		{
+			Nan::HandleScope scope;
+			Local<Value> argv[] = { Nan::New(m_channel), Nan::New(m_param) };
+			Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(s_channel_finished_callback), (m_param < 0)?(1):(countof(argv)), argv);
+		}
+	}
+};
+
+static void _channel_finished_callback(int channel)
+{
+	int err = Nanx::SimpleTask::Run(new TaskChannelFinished(channel));
+}
+
+// audio device
+
+static int s_audio_frequency = 0;
+static ::Uint16 s_audio_format = 0;
+static int s_audio_channels = 0;
+
+static int _audio_frame_size(void)
+{
+	return (SDL_AUDIO_BITSIZE(s_audio_format) / 8) * s_audio_channels;
+}
+
+// audio thread events
+//
+// The audio thread must not allocate or call into script, so it raises event
+// bits that a uv_async handle drains on the main thread.
+
+enum MixAudioEvent
+{
+	MIX_EVENT_THREAD = 1 << 0, // the audio thread mixed its first buffer
+	MIX_EVENT_CHANNEL_HALT = 1 << 1, // a resampled channel ran out of source
+	MIX_EVENT_ENVELOPE = 1 << 2, // an envelope completed
+	MIX_EVENT_MUSIC_STREAM = 1 << 3, // a music stream starved or needs input
+	MIX_EVENT_ADAPTIVE = 1 << 4 // the adaptive buffer proposed a decision
+};
+
+static uv_async_t s_audio_async;
+static bool s_audio_async_ready = false;
+static SDL_atomic_t s_audio_events;
+
+static void _audio_events_drain(uv_async_t* handle);
+
+// main thread, from module init
+static void _audio_events_init(void)
+{
+	if (s_audio_async_ready) { return; }
+	uv_async_init(uv_default_loop(), &s_audio_async, _audio_events_drain);
+	uv_unref((uv_handle_t*) &s_audio_async); // does not keep the process alive
+	s_audio_async_ready = true;
+}
+
+// any thread; never blocks or allocates
+static void _audio_event_raise(int event)
+{
+	int events;
+	do { events = SDL_AtomicGet(&s_audio_events); } while (!SDL_AtomicCAS(&s_audio_events, events, events | event));
+	if (s_audio_async_ready) { uv_async_send(&s_audio_async); }
+}
+
+// pcm conversion
+//
+// Device format samples <-> float in [-1, 1].  AUDIO_S16SYS and AUDIO_F32SYS
+// have vector paths; other formats go through the generic sample codec.
+
+static float _pcm_read_sample(const Uint8* src, ::Uint16 format)
+{
+	int bytes = SDL_AUDIO_BITSIZE(format) / 8;
+	Uint32 raw = 0;
+	for (int i = 0; i < bytes; ++i)
+	{
+		int shift = (SDL_AUDIO_ISBIGENDIAN(format))?(8 * (bytes - 1 - i)):(8 * i);
+		raw |= ((Uint32) src[i]) << shift;
+	}
+	if (SDL_AUDIO_ISFLOAT(format)) { float value; SDL_memcpy(&value, &raw, sizeof(value)); return value; }
+	int bits = SDL_AUDIO_BITSIZE(format);
+	double scale = ldexp(1.0, bits - 1);
+	if (SDL_AUDIO_ISSIGNED(format)) { return (float) ((double) (Sint32) (raw << (32 - bits)) / 2147483648.0); }
+	return (float) (((double) raw - scale) / scale);
+}
+
+static void _pcm_write_sample(Uint8* dst, float value, ::Uint16 format)
+{
+	int bytes = SDL_AUDIO_BITSIZE(format) / 8;
+	Uint32 raw = 0;
+	if (SDL_AUDIO_ISFLOAT(format))
+	{
+		SDL_memcpy(&raw, &value, sizeof(raw));
+	}
+	else
+	{
+		int bits = SDL_AUDIO_BITSIZE(format);
+		double scale = ldexp(1.0, bits - 1);
+		double v = floor(((value < -1.0f)?(-1.0):(value > 1.0f)?(1.0):(value)) * scale + 0.5);
+		if (v > (scale - 1)) { v = scale - 1; }
+		Sint64 s = (Sint64) v;
+		if (!SDL_AUDIO_ISSIGNED(format)) { s += (Sint64) scale; }
+		raw = (Uint32) s;
+	}
+	for (int i = 0; i < bytes; ++i)
+	{
+		int shift = (SDL_AUDIO_ISBIGENDIAN(format))?(8 * (bytes - 1 - i)):(8 * i);
+		dst[i] = (Uint8) (raw >> shift);
+	}
+}
+
+static void _pcm_to_float(const Uint8* src, float* dst, int count, ::Uint16 format)
+{
+	int i = 0;
+	if (format == AUDIO_S16SYS)
+	{
+		const Sint16* s16 = (const Sint16*) src;
+		#if defined(__SSE2__)
+		const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*) (s16 + i));
+			__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+			__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+			_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+		}
+		#elif defined(MIX_NEON)
+		for (; i + 8 <= count; i += 8)
+		{
+			int16x8_t v = vld1q_s16(s16 + i);
+			vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), 1.0f / 32768.0f));
+			vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), 1.0f / 32768.0f));
+		}
+		#endif
+		for (; i < count; ++i) { dst[i] = s16[i] * (1.0f / 32768.0f); }
+	}
+	else if (format == AUDIO_F32SYS)
+	{
+		SDL_memcpy(dst, src, count * sizeof(float));
+	}
+	else
+	{
+		int bytes = SDL_AUDIO_BITSIZE(format) / 8;
+		for (; i < count; ++i) { dst[i] = _pcm_read_sample(src + (i * bytes), format); }
+	}
+}
+
+static void _pcm_from_float(const float* src, Uint8* dst, int count, ::Uint16 format)
+{
+	int i = 0;
+	if (format == AUDIO_S16SYS)
+	{
+		Sint16* s16 = (Sint16*) dst;
+		#if defined(__SSE2__)
+		const __m128 scale = _mm_set1_ps(32768.0f);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), scale));
+			__m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale));
+			_mm_storeu_si128((__m128i*) (s16 + i), _mm_packs_epi32(lo, hi));
+		}
+		#elif defined(MIX_NEON)
+		for (; i + 8 <= count; i += 8)
+		{
+			int32x4_t lo = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), 32768.0f));
+			int32x4_t hi = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i + 4), 32768.0f));
+			vst1q_s16(s16 + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+		}
+		#endif
+		for (; i < count; ++i)
+		{
+			float v = floorf(src[i] * 32768.0f + 0.5f);
+			s16[i] = (Sint16) ((v < -32768.0f)?(-32768.0f):(v > 32767.0f)?(32767.0f):(v));
+		}
+	}
+	else if (format == AUDIO_F32SYS)
+	{
+		SDL_memcpy(dst, src, count * sizeof(float));
+	}
+	else
+	{
+		int bytes = SDL_AUDIO_BITSIZE(format) / 8;
+		for (; i < count; ++i) { _pcm_write_sample(dst + (i * bytes), src[i], format); }
+	}
+}
+
+// vector kernels
+
+static void _kernel_peak_sumsq(const float* src, int count, float* peak, double* sumsq)
+{
+	int i = 0;
+	float p = *peak;
+	double s = 0;
+	#if defined(__SSE2__)
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 vp = _mm_setzero_ps(), vs = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 v = _mm_loadu_ps(src + i);
+		vp = _mm_max_ps(vp, _mm_and_ps(v, abs_mask));
+		vs = _mm_add_ps(vs, _mm_mul_ps(v, v));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, vp); for (int k = 0; k < 4; ++k) { if (lanes[k] > p) { p = lanes[k]; } }
+	_mm_storeu_ps(lanes, vs); for (int k = 0; k < 4; ++k) { s += lanes[k]; }
+	#elif defined(MIX_NEON)
+	float32x4_t vp = vdupq_n_f32(0), vs = vdupq_n_f32(0);
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4_t v = vld1q_f32(src + i);
+		vp = vmaxq_f32(vp, vabsq_f32(v));
+		vs = vmlaq_f32(vs, v, v);
+	}
+	float lanes[4];
+	vst1q_f32(lanes, vp); for (int k = 0; k < 4; ++k) { if (lanes[k] > p) { p = lanes[k]; } }
+	vst1q_f32(lanes, vs); for (int k = 0; k < 4; ++k) { s += lanes[k]; }
+	#endif
+	for (; i < count; ++i)
+	{
+		float a = fabsf(src[i]);
+		if (a > p) { p = a; }
+		s += (double) src[i] * src[i];
+	}
+	*peak = p;
+	*sumsq += s;
+}
+
+static void _kernel_min_max(const float* src, int count, float* min, float* max)
+{
+	int i = 0;
+	float lo = *min, hi = *max;
+	#if defined(__SSE2__)
+	if (count >= 4)
+	{
+		__m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 v = _mm_loadu_ps(src + i);
+			vlo = _mm_min_ps(vlo, v);
+			vhi = _mm_max_ps(vhi, v);
+		}
+		float lanes[4];
+		_mm_storeu_ps(lanes, vlo); for (int k = 0; k < 4; ++k) { if (lanes[k] < lo) { lo = lanes[k]; } }
+		_mm_storeu_ps(lanes, vhi); for (int k = 0; k < 4; ++k) { if (lanes[k] > hi) { hi = lanes[k]; } }
+	}
+	#elif defined(MIX_NEON)
+	if (count >= 4)
+	{
+		float32x4_t vlo = vdupq_n_f32(lo), vhi = vdupq_n_f32(hi);
+		for (; i + 4 <= count; i += 4)
+		{
+			float32x4_t v = vld1q_f32(src + i);
+			vlo = vminq_f32(vlo, v);
+			vhi = vmaxq_f32(vhi, v);
+		}
+		float lanes[4];
+		vst1q_f32(lanes, vlo); for (int k = 0; k < 4; ++k) { if (lanes[k] < lo) { lo = lanes[k]; } }
+		vst1q_f32(lanes, vhi); for (int k = 0; k < 4; ++k) { if (lanes[k] > hi) { hi = lanes[k]; } }
+	}
+	#endif
+	for (; i < count; ++i)
+	{
+		if (src[i] < lo) { lo = src[i]; }
+		if (src[i] > hi) { hi = src[i]; }
+	}
+	*min = lo;
+	*max = hi;
+}
+
+static void _kernel_gain(float* buf, int count, float gain)
+{
+	int i = 0;
+	#if defined(__SSE2__)
+	const __m128 g = _mm_set1_ps(gain);
+	for (; i + 4 <= count; i += 4) { _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), g)); }
+	#elif defined(MIX_NEON)
+	for (; i + 4 <= count; i += 4) { vst1q_f32(buf + i, vmulq_n_f32(vld1q_f32(buf + i), gain)); }
+	#endif
+	for (; i < count; ++i) { buf[i] *= gain; }
+}
+
+#if defined(MIX_AVX2)
+static bool s_kernel_avx2 = false; // from SDL_HasAVX2 at module init
+
+// the samples of _kernel_mix_ramp it handled, a multiple of 8 from 0
+MIX_AVX2_TARGET static int _kernel_mix_ramp_avx2(const float* src, float* bus, int count, int channels, const float* start, const float* step)
+{
+	int i = 0;
+	float lanes[8], delta[8];
+	for (int k = 0; k < 8; ++k) { lanes[k] = start[k % channels] + step[k % channels] * (k / channels); delta[k] = step[k % channels] * (8 / channels); }
+	__m256 g = _mm256_loadu_ps(lanes), d = _mm256_loadu_ps(delta);
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm256_storeu_ps(bus + i, _mm256_add_ps(_mm256_loadu_ps(bus + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), g)));
+		g = _mm256_add_ps(g, d);
+	}
+	return i;
+}
+#endif
+
+// bus += src * gain for interleaved mono or stereo, with the gain of each
+// channel ramped per frame from g0 to g1
+static void _kernel_mix_ramp(const float* src, float* bus, int frames, int channels, const float* g0, const float* g1)
+{
+	int i = 0;
+	int count = frames * channels;
+	float start[2], step[2];
+	for (int c = 0; c < channels; ++c) { start[c] = g0[c]; step[c] = (g1[c] - g0[c]) / frames; }
+	#if defined(MIX_AVX2)
+	if (s_kernel_avx2) { i = _kernel_mix_ramp_avx2(src, bus, count, channels, start, step); }
+	#endif
+	#if defined(__SSE2__)
+	// from wherever the AVX2 pass stopped, a whole number of frames
+	float lanes[4], delta[4];
+	for (int k = 0; k < 4; ++k) { lanes[k] = start[(i + k) % channels] + step[(i + k) % channels] * ((i + k) / channels); delta[k] = step[k % channels] * (4 / channels); }
+	__m128 g = _mm_loadu_ps(lanes), d = _mm_loadu_ps(delta);
+	for (; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_ps(bus + i, _mm_add_ps(_mm_loadu_ps(bus + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+		g = _mm_add_ps(g, d);
+	}
+	#elif defined(MIX_NEON)
+	float lanes[4], delta[4];
+	for (int k = 0; k < 4; ++k) { lanes[k] = start[k % channels] + step[k % channels] * (k / channels); delta[k] = step[k % channels] * (4 / channels); }
+	float32x4_t g = vld1q_f32(lanes), d = vld1q_f32(delta);
+	for (; i + 4 <= count; i += 4)
+	{
+		vst1q_f32(bus + i, vmlaq_f32(vld1q_f32(bus + i), vld1q_f32(src + i), g));
+		g = vaddq_f32(g, d);
+	}
+	#endif
+	for (; i < count; ++i)
+	{
+		int c = i % channels;
+		bus[i] += src[i] * (start[c] + step[c] * (i / channels));
+	}
+}
+
+// a += x * h on split complex arrays
+static void _kernel_complex_mac(const float* xr, const float* xi, const float* hr, const float* hi, float* ar, float* ai, int count)
+{
+	int i = 0;
+	#if defined(__SSE2__)
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 a = _mm_loadu_ps(xr + i), b = _mm_loadu_ps(xi + i), c = _mm_loadu_ps(hr + i), d = _mm_loadu_ps(hi + i);
+		_mm_storeu_ps(ar + i, _mm_add_ps(_mm_loadu_ps(ar + i), _mm_sub_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, d))));
+		_mm_storeu_ps(ai + i, _mm_add_ps(_mm_loadu_ps(ai + i), _mm_add_ps(_mm_mul_ps(a, d), _mm_mul_ps(b, c))));
+	}
+	#elif defined(MIX_NEON)
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4_t a = vld1q_f32(xr + i), b = vld1q_f32(xi + i), c = vld1q_f32(hr + i), d = vld1q_f32(hi + i);
+		vst1q_f32(ar + i, vmlsq_f32(vmlaq_f32(vld1q_f32(ar + i), a, c), b, d));
+		vst1q_f32(ai + i, vmlaq_f32(vmlaq_f32(vld1q_f32(ai + i), a, d), b, c));
+	}
+	#endif
+	for (; i < count; ++i)
+	{
+		ar[i] += xr[i] * hr[i] - xi[i] * hi[i];
+		ai[i] += xr[i] * hi[i] + xi[i] * hr[i];
+	}
+}
+
+// 4-point, 3rd-order Hermite interpolation of p1..p2 at t in [0, 1)
+static void _kernel_hermite(const float* p0, const float* p1, const float* p2, const float* p3, const float* t, float* out, int count)
+{
+	int i = 0;
+	#if defined(__SSE2__)
+	const __m128 half = _mm_set1_ps(0.5f), one_half = _mm_set1_ps(1.5f), two = _mm_set1_ps(2.0f), two_half = _mm_set1_ps(2.5f);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 a = _mm_loadu_ps(p0 + i), b = _mm_loadu_ps(p1 + i), c = _mm_loadu_ps(p2 + i), d = _mm_loadu_ps(p3 + i), x = _mm_loadu_ps(t + i);
+		__m128 c1 = _mm_mul_ps(half, _mm_sub_ps(c, a));
+		__m128 c2 = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(a, _mm_mul_ps(two_half, b)), _mm_mul_ps(two, c)), _mm_mul_ps(half, d));
+		__m128 c3 = _mm_add_ps(_mm_mul_ps(half, _mm_sub_ps(d, a)), _mm_mul_ps(one_half, _mm_sub_ps(b, c)));
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(c3, x), c2), x), c1), x), b));
+	}
+	#elif defined(MIX_NEON)
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4_t a = vld1q_f32(p0 + i), b = vld1q_f32(p1 + i), c = vld1q_f32(p2 + i), d = vld1q_f32(p3 + i), x = vld1q_f32(t + i);
+		float32x4_t c1 = vmulq_n_f32(vsubq_f32(c, a), 0.5f);
+		float32x4_t c2 = vsubq_f32(vaddq_f32(vsubq_f32(a, vmulq_n_f32(b, 2.5f)), vmulq_n_f32(c, 2.0f)), vmulq_n_f32(d, 0.5f));
+		float32x4_t c3 = vaddq_f32(vmulq_n_f32(vsubq_f32(d, a), 0.5f), vmulq_n_f32(vsubq_f32(b, c), 1.5f));
+		vst1q_f32(out + i, vaddq_f32(vmulq_f32(vaddq_f32(vmulq_f32(vaddq_f32(vmulq_f32(c3, x), c2), x), c1), x), b));
+	}
+	#endif
+	for (; i < count; ++i)
+	{
+		float c1 = 0.5f * (p2[i] - p0[i]);
+		float c2 = p0[i] - 2.5f * p1[i] + 2.0f * p2[i] - 0.5f * p3[i];
+		float c3 = 0.5f * (p3[i] - p0[i]) + 1.5f * (p1[i] - p2[i]);
+		out[i] = ((c3 * t[i] + c2) * t[i] + c1) * t[i] + p1[i];
+	}
+}
+
+// chunk analysis
+
+// ITU-R BS.1770 K-weighting: high shelf followed by a high pass
+class MixKWeighting
+{
+public:
+	double m_b[2][3];
+	double m_a[2][3];
+	double m_z[2][2];
+public:
+	MixKWeighting(int frequency)
+	{
+		SDL_zero(m_z);
+		double K = tan(M_PI * 1681.974450955533 / frequency);
+		double Q = 0.7071752369554196;
+		double Vh = pow(10.0, 3.999843853973347 / 20.0);
+		double Vb = pow(Vh, 0.4996667741545416);
+		double a0 = 1.0 + K / Q + K * K;
+		m_b[0][0] = (Vh + Vb * K / Q + K * K) / a0;
+		m_b[0][1] = 2.0 * (K * K - Vh) / a0;
+		m_b[0][2] = (Vh - Vb * K / Q + K * K) / a0;
+		m_a[0][1] = 2.0 * (K * K - 1.0) / a0;
+		m_a[0][2] = (1.0 - K / Q + K * K) / a0;
+		K = tan(M_PI * 38.13547087602444 / frequency);
+		Q = 0.5003270373238773;
+		a0 = 1.0 + K / Q + K * K;
+		m_b[1][0] = 1.0; m_b[1][1] = -2.0; m_b[1][2] = 1.0;
+		m_a[1][1] = 2.0 * (K * K - 1.0) / a0;
+		m_a[1][2] = (1.0 - K / Q + K * K) / a0;
+		m_a[0][0] = m_a[1][0] = 1.0;
+	}
+	double Process(double x)
+	{
+		for (int stage = 0; stage < 2; ++stage)
+		{
+			// transposed direct form II
+			double y = m_b[stage][0] * x + m_z[stage][0];
+			m_z[stage][0] = m_b[stage][1] * x - m_a[stage][1] * y + m_z[stage][1];
+			m_z[stage][1] = m_b[stage][2] * x - m_a[stage][2] * y;
+			x = y;
+		}
+		return x;
+	}
+};
+
+// hops hold the K-weighted energy of hop_frames frames each, the last hop
+// only the remainder of frames
+static double _loudness_gated(const double* hops, int hop_count, int hop_frames, int frames)
+{
+	// 400 ms blocks at 75% overlap are four 100 ms hops
+	int block_hops = SDL_min(4, hop_count);
+	int block_count = hop_count - block_hops + 1;
+	if (block_count <= 0) { return -HUGE_VAL; }
+	double* blocks = new double[block_count];
+	double sum = 0;
+	int count = 0;
+	for (int b = 0; b < block_count; ++b)
+	{
+		double energy = 0;
+		int length = 0;
+		for (int h = 0; h < block_hops; ++h)
+		{
+			energy += hops[b + h];
+			length += SDL_min(hop_frames, frames - ((b + h) * hop_frames));
+		}
+		blocks[b] = energy / length;
+		if ((-0.691 + 10.0 * log10(blocks[b])) > -70.0) { sum += blocks[b]; ++count; }
+	}
+	double loudness = -HUGE_VAL;
+	if (count > 0)
+	{
+		double gate = -0.691 + 10.0 * log10(sum / count) - 10.0;
+		double gated_sum = 0;
+		int gated_count = 0;
+		for (int b = 0; b < block_count; ++b)
+		{
+			double l = -0.691 + 10.0 * log10(blocks[b]);
+			if ((l > -70.0) && (l > gate)) { gated_sum += blocks[b]; ++gated_count; }
+		}
+		if (gated_count > 0) { loudness = -0.691 + 10.0 * log10(gated_sum / gated_count); }
+	}
+	delete[] blocks;
+	return loudness;
+}
+
+// bins that got no sample, when there are more bins than frames, read 0
+static void _envelope_fill_empty(MixChunkAnalysis* analysis)
+{
+	for (int i = 0; i < analysis->m_envelope_size; ++i)
+	{
+		float* bin = &analysis->m_envelope[i * 2];
+		if (bin[0] > bin[1]) { bin[0] = bin[1] = 0.0f; }
+	}
+}
+
+static MixChunkAnalysis* _chunk_analyze(const Uint8* abuf, Uint32 alen, int frequency, ::Uint16 format, int channels, int envelope_size, double silence_db)
+{
+	static const int k_block_frames = 1024;
+	int sample_size = SDL_AUDIO_BITSIZE(format) / 8;
+	int frame_size = sample_size * channels;
+	if ((frame_size <= 0) || (frequency <= 0)) { return NULL; }
+	int frames = (int) (alen / frame_size);
+	MixChunkAnalysis* analysis = new MixChunkAnalysis();
+	analysis->m_duration = frames * 1000.0 / frequency;
+	if (envelope_size > 0)
+	{
+		analysis->m_envelope_size = envelope_size;
+		analysis->m_envelope = new float[envelope_size * 2];
+		// empty bins, so each starts from its first sample
+		for (int i = 0; i < envelope_size; ++i) { analysis->m_envelope[i * 2 + 0] = HUGE_VALF; analysis->m_envelope[i * 2 + 1] = -HUGE_VALF; }
+	}
+	if (frames == 0) { _envelope_fill_empty(analysis); return analysis; }
+
+	float threshold = (float) pow(10.0, silence_db / 20.0);
+	int hop_frames = SDL_max(1, frequency / 10);
+	int hop_count = (frames + hop_frames - 1) / hop_frames;
+	double* hops = new double[hop_count];
+	for (int h = 0; h < hop_count; ++h) { hops[h] = 0; }
+	MixKWeighting** weighting = new MixKWeighting*[channels];
+	for (int c = 0; c < channels; ++c) { weighting[c] = new MixKWeighting(frequency); }
+
+	float* block = new float[k_block_frames * channels];
+	float peak = 0;
+	double sumsq = 0;
+	int first_loud = -1, last_loud = -1;
+	for (int frame = 0; frame < frames; frame += k_block_frames)
+	{
+		int count = SDL_min(k_block_frames, frames - frame);
+		_pcm_to_float(abuf + (frame * frame_size), block, count * channels, format);
+
+		float block_peak = 0;
+		_kernel_peak_sumsq(block, count * channels, &block_peak, &sumsq);
+		if (block_peak > peak) { peak = block_peak; }
+
+		if (block_peak > threshold)
+		{
+			for (int i = 0; (first_loud < 0) && (i < count * channels); ++i)
+			{
+				if (fabsf(block[i]) > threshold) { first_loud = frame + (i / channels); }
+			}
+			for (int i = count * channels - 1; i >= 0; --i)
+			{
+				if (fabsf(block[i]) > threshold) { last_loud = frame + (i / channels); break; }
+			}
+		}
+
+		for (int start = 0; (envelope_size > 0) && (start < count); )
+		{
+			int bin = (int) (((Sint64) (frame + start) * envelope_size) / frames);
+			int bin_end = (int) ((((Sint64) (bin + 1) * frames) + envelope_size - 1) / envelope_size) - frame;
+			int end = SDL_min(count, SDL_max(start + 1, bin_end));
+			_kernel_min_max(block + (start * channels), (end - start) * channels, &analysis->m_envelope[bin * 2 + 0], &analysis->m_envelope[bin * 2 + 1]);
+			start = end;
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			double energy = 0;
+			for (int c = 0; c < channels; ++c)
+			{
+				double y = weighting[c]->Process(block[i * channels + c]);
+				energy += y * y;
+			}
+			hops[(frame + i) / hop_frames] += energy;
+		}
+	}
+	delete[] block;
+	for (int c = 0; c < channels; ++c) { delete weighting[c]; }
+	delete[] weighting;
+	_envelope_fill_empty(analysis);
+
+	analysis->m_peak = peak;
+	analysis->m_rms = sqrt(sumsq / ((double) frames * channels));
+	analysis->m_loudness = _loudness_gated(hops, hop_count, hop_frames, frames);
+	delete[] hops;
+	if (first_loud < 0)
+	{
+		analysis->m_leading_silence = analysis->m_duration;
+		analysis->m_trailing_silence = analysis->m_duration;
+	}
+	else
+	{
+		analysis->m_leading_silence = first_loud * 1000.0 / frequency;
+		analysis->m_trailing_silence = (frames - 1 - last_loud) * 1000.0 / frequency;
+	}
+	return analysis;
+}
+
+// chunk transforms
+//
+// Applied in place on the loader thread before the chunk is handed to script.
+// The chunk keeps SDL_mixer ownership of abuf (allocated = 1, SDL_free).
+
+static void _chunk_fade(Uint8* abuf, int frames, ::Uint16 format, int channels, bool fade_in)
+{
+	static const int k_block_frames = 256;
+	int frame_size = (SDL_AUDIO_BITSIZE(format) / 8) * channels;
+	float block[k_block_frames * 8];
+	int block_frames = SDL_min(k_block_frames, (int) (countof(block) / channels));
+	for (int frame = 0; frame < frames; frame += block_frames)
+	{
+		int count = SDL_min(block_frames, frames - frame);
+		_pcm_to_float(abuf + (frame * frame_size), block, count * channels, format);
+		for (int i = 0; i < count; ++i)
+		{
+			// half cosine from 0 to 1
+			double t = (double) (frame + i) / frames;
+			float gain = (float) (0.5 - 0.5 * cos(M_PI * ((fade_in)?(t):(1.0 - t))));
+			for (int c = 0; c < channels; ++c) { block[i * channels + c] *= gain; }
+		}
+		_pcm_from_float(block, abuf + (frame * frame_size), count * channels, format);
+	}
+}
+
+static bool _chunk_trim(Mix_Chunk* chunk, int frequency, ::Uint16 format, int channels, double threshold_db, double fade_ms)
+{
+	static const int k_block_frames = 1024;
+	int frame_size = (SDL_AUDIO_BITSIZE(format) / 8) * channels;
+	if ((frame_size <= 0) || !chunk->allocated) { return false; }
+	int frames = (int) (chunk->alen / frame_size);
+	float threshold = (float) pow(10.0, threshold_db / 20.0);
+	float* block = new float[k_block_frames * channels];
+	int first = -1, last = -1;
+	for (int frame = 0; frame < frames; frame += k_block_frames)
+	{
+		int count = SDL_min(k_block_frames, frames - frame);
+		_pcm_to_float(chunk->abuf + (frame * frame_size), block, count * channels, format);
+		float peak = 0;
+		double sumsq = 0;
+		_kernel_peak_sumsq(block, count * channels, &peak, &sumsq);
+		if (peak <= threshold) { continue; }
+		for (int i = 0; (first < 0) && (i < count * channels); ++i)
+		{
+			if (fabsf(block[i]) > threshold) { first = frame + (i / channels); }
+		}
+		for (int i = count * channels - 1; i >= 0; --i)
+		{
+			if (fabsf(block[i]) > threshold) { last = frame + (i / channels); break; }
+		}
+	}
+	delete[] block;
+	if (first < 0) { return false; } // all silence, leave as loaded
+
+	// keep the fade length of quiet lead-in and tail around the audible range
+	int fade = (int) (fade_ms * frequency / 1000.0);
+	int start = SDL_max(0, first - fade);
+	int end = SDL_min(frames, last + 1 + fade);
+	if ((start == 0) && (end == frames)) { return false; }
+	Uint32 alen = (Uint32) ((end - start) * frame_size);
+	Uint8* abuf = (Uint8*) SDL_malloc(alen);
+	if (!abuf) { return false; }
+	SDL_memcpy(abuf, chunk->abuf + (start * frame_size), alen);
+	if (first - start > 0) { _chunk_fade(abuf, first - start, format, channels, true); }
+	if (end - 1 - last > 0) { _chunk_fade(abuf + ((last + 1 - start) * frame_size), end - 1 - last, format, channels, false); }
+	SDL_free(chunk->abuf);
+	chunk->abuf = abuf;
+	chunk->alen = alen;
+	return true;
+}
+
+static void _chunk_gain(Mix_Chunk* chunk, ::Uint16 format, float gain)
+{
+	static const int k_block_samples = 4096;
+	int sample_size = SDL_AUDIO_BITSIZE(format) / 8;
+	if (sample_size <= 0) { return; }
+	int samples = (int) (chunk->alen / sample_size);
+	float* block = new float[k_block_samples];
+	for (int sample = 0; sample < samples; sample += k_block_samples)
+	{
+		int count = SDL_min(k_block_samples, samples - sample);
+		_pcm_to_float(chunk->abuf + (sample * sample_size), block, count, format);
+		_kernel_gain(block, count, gain);
+		_pcm_from_float(block, chunk->abuf + (sample * sample_size), count, format);
+	}
+	delete[] block;
+}
+
+enum MixNormalize { MIX_NORMALIZE_NONE, MIX_NORMALIZE_PEAK, MIX_NORMALIZE_LOUDNESS };
+
+static float _chunk_peak(const Mix_Chunk* chunk, ::Uint16 format)
+{
+	static const int k_block_samples = 4096;
+	int sample_size = SDL_AUDIO_BITSIZE(format) / 8;
+	if (sample_size <= 0) { return 0; }
+	int samples = (int) (chunk->alen / sample_size);
+	float* block = new float[k_block_samples];
+	float peak = 0;
+	double sumsq = 0;
+	for (int sample = 0; sample < samples; sample += k_block_samples)
+	{
+		int count = SDL_min(k_block_samples, samples - sample);
+		_pcm_to_float(chunk->abuf + (sample * sample_size), block, count, format);
+		_kernel_peak_sumsq(block, count, &peak, &sumsq);
+	}
+	delete[] block;
+	return peak;
+}
+
+static void _chunk_normalize(Mix_Chunk* chunk, int frequency, ::Uint16 format, int channels, MixNormalize mode, double target, double ceiling_db)
+{
+	double gain = 1.0;
+	float peak = 0;
+	if (mode == MIX_NORMALIZE_LOUDNESS)
+	{
+		MixChunkAnalysis* analysis = _chunk_analyze(chunk->abuf, chunk->alen, frequency, format, channels, 0, -HUGE_VAL);
+		if (!analysis) { return; }
+		if (analysis->m_loudness > -HUGE_VAL)
+		{
+			gain = pow(10.0, (target - analysis->m_loudness) / 20.0);
+		}
+		peak = analysis->m_peak;
+		delete analysis;
+	}
+	else
+	{
+		// peak only, no K-weighted loudness pass
+		peak = _chunk_peak(chunk, format);
+		if (peak > 0) { gain = pow(10.0, target / 20.0) / peak; }
+	}
+	if (peak > 0)
+	{
+		gain = SDL_min(gain, pow(10.0, ceiling_db / 20.0) / peak);
+	}
+	if (fabs(gain - 1.0) > 1e-4) { _chunk_gain(chunk, format, (float) gain); }
+}
+
+// audio thread
+//
+// A post effect runs on the SDL audio thread once per mix buffer; it records
+// the thread id and the wakeup interval so the thread can be tuned from the
+// main thread.  Stats are written under the audio device lock.
+
+struct MixAudioThreadStats
+{
+	long m_tid; // kernel thread id, 0 until the first mix buffer
+	Uint64 m_last; // performance counter at the last callback
+	Uint32 m_callbacks;
+	Uint32 m_late; // intervals longer than 1.5 periods
+	double m_period; // seconds, from the last buffer size
+	double m_sum; // interval - period
+	double m_sum_sq;
+	double m_max;
+};
+
+static MixAudioThreadStats s_audio_thread;
+
+static void _audio_thread_reset(bool forget_thread)
+{
+	long keep = s_audio_thread.m_tid;
+	SDL_zero(s_audio_thread);
+	if (!forget_thread) { s_audio_thread.m_tid = keep; }
+}
+
+static void _audio_thread_sample(int len)
+{
+	Uint64 now = SDL_GetPerformanceCounter();
+	if (s_audio_thread.m_tid == 0)
+	{
+		#if defined(__linux__)
+		s_audio_thread.m_tid = (long) syscall(SYS_gettid);
+		#else
+		s_audio_thread.m_tid = (long) SDL_ThreadID();
+		#endif
+		_audio_event_raise(MIX_EVENT_THREAD);
+	}
+	int frame_size = _audio_frame_size();
+	if ((frame_size > 0) && (s_audio_frequency > 0))
+	{
+		s_audio_thread.m_period = (double) (len / frame_size) / s_audio_frequency;
+	}
+	if (s_audio_thread.m_last != 0)
+	{
+		double interval = (double) (now - s_audio_thread.m_last) / SDL_GetPerformanceFrequency();
+		double jitter = interval - s_audio_thread.m_period;
+		s_audio_thread.m_callbacks++;
+		s_audio_thread.m_sum += jitter;
+		s_audio_thread.m_sum_sq += jitter * jitter;
+		if (fabs(jitter) > s_audio_thread.m_max) { s_audio_thread.m_max = fabs(jitter); }
+		if (interval > (1.5 * s_audio_thread.m_period)) { s_audio_thread.m_late++; }
+	}
+	s_audio_thread.m_last = now;
+}
+
+// post effect
+
+static void _bus_update(int len);
+static void _clock_update(int len);
+static void _clock_reset(void);
+static void _adaptive_update(int len);
+static void _adaptive_reset(void);
+static void _engine_process(Uint8* stream, int len);
+static void _send_process(Uint8* stream, int len);
+
+static void _post_effect(int chan, void* stream, int len, void* udata)
+{
+	_audio_thread_sample(len);
+	_bus_update(len);
+	_engine_process((Uint8*) stream, len);
+	_send_process((Uint8*) stream, len);
+	_clock_update(len);
+	_adaptive_update(len);
+}
+
+static bool s_post_effect_registered = false;
+
+// SDL_mixer calls this when it drops the effect, e.g. in Mix_CloseAudio
+static void _post_effect_done(int chan, void* udata)
+{
+	s_post_effect_registered = false;
+}
+
+// after every open: the spec may have changed and a new audio thread is
+// coming; a first open also starts the clock and the adaptive windows from
+// zero, an adaptive reopen keeps counting from where the old device stopped
+static void _post_effect_init(bool first)
+{
+	Mix_QuerySpec(&s_audio_frequency, &s_audio_format, &s_audio_channels);
+	_audio_thread_reset(true);
+	if (first)
+	{
+		_clock_reset();
+		_adaptive_reset();
+	}
+	if (!s_post_effect_registered)
+	{
+		s_post_effect_registered = (Mix_RegisterEffect(MIX_CHANNEL_POST, _post_effect, _post_effect_done, NULL) != 0);
+	}
+}
+
+static void _post_effect_quit(void)
+{
+	// SDL_mixer drops post effects in Mix_CloseAudio
+	s_audio_frequency = 0;
+	s_audio_format = 0;
+	s_audio_channels = 0;
+	_audio_thread_reset(true);
+	_clock_reset();
+}
+
+// envelopes
+//
+// Breakpoint automation evaluated on the audio thread.  Time starts at the
+// buffer after the envelope is set, or when an idle channel next plays; the
+// last value holds once it completes.  Completion is reported through the
+// channel finished callback with the envelope parameter as a second argument.
+
+enum MixEnvelopeParam { MIX_ENVELOPE_VOLUME, MIX_ENVELOPE_PAN, MIX_ENVELOPE_PARAM_COUNT };
+enum MixEnvelopeCurve { MIX_CURVE_LINEAR, MIX_CURVE_EXPONENTIAL, MIX_CURVE_EQUAL_POWER };
+
+struct MixEnvelope
+{
+	static const int k_max_points = 64;
+	bool m_active;
+	bool m_done;
+	bool m_done_pending; // completed, not yet reported on the main thread
+	MixEnvelopeCurve m_curve;
+	int m_count;
+	double m_time[k_max_points]; // seconds
+	double m_value[k_max_points];
+	double m_now; // seconds since start
+};
+
+static double _envelope_value(const MixEnvelope* envelope, double t)
+{
+	if (t <= envelope->m_time[0]) { return envelope->m_value[0]; }
+	int last = envelope->m_count - 1;
+	if (t >= envelope->m_time[last]) { return envelope->m_value[last]; }
+	int i = 0;
+	while (t >= envelope->m_time[i + 1]) { ++i; }
+	double a = envelope->m_value[i], b = envelope->m_value[i + 1];
+	double span = envelope->m_time[i + 1] - envelope->m_time[i];
+	double x = (span > 0)?((t - envelope->m_time[i]) / span):(1.0);
+	switch (envelope->m_curve)
+	{
+	case MIX_CURVE_EXPONENTIAL:
+		if ((a >= 0) == (b >= 0))
+		{
+			// -80 dB floor so fades to and from silence still curve
+			double sa = ((a + b) >= 0)?(1.0):(-1.0);
+			double fa = SDL_max(fabs(a), 1e-4), fb = SDL_max(fabs(b), 1e-4);
+			double v = fa * pow(fb / fa, x);
+			return (v <= 1e-4)?(0.0):(sa * v);
+		}
+		return a + (b - a) * x;
+	case MIX_CURVE_EQUAL_POWER:
+		if ((a >= 0) == (b >= 0))
+		{
+			// constant power: a == b holds the value across the segment
+			double ca = a * cos(x * M_PI / 2), sb = b * sin(x * M_PI / 2);
+			return (((a + b) >= 0)?(1.0):(-1.0)) * sqrt(ca * ca + sb * sb);
+		}
+		return a + (b - a) * x;
+	default:
+	case MIX_CURVE_LINEAR:
+		return a + (b - a) * x;
+	}
+}
+
+// advance by the given seconds; the first time the envelope completes it is
+// marked for the main thread
+static void _envelope_advance(MixEnvelope* envelope, double seconds)
+{
+	envelope->m_now += seconds;
+	if (!envelope->m_done && (envelope->m_now >= envelope->m_time[envelope->m_count - 1]))
+	{
+		envelope->m_done = true;
+		envelope->m_done_pending = true;
+		_audio_event_raise(MIX_EVENT_ENVELOPE);
+	}
+}
+
+// true once for a completion the audio thread marked; audio device locked
+static bool _envelope_take_done(MixEnvelope* envelope)
+{
+	if (!envelope || !envelope->m_done_pending) { return false; }
+	envelope->m_done_pending = false;
+	return true;
+}
+
+static MixEnvelope* s_music_envelope = NULL;
+
+// native channels
+//
+// Per-channel state for the native channel effect.  SDL_mixer removes
+// effects when a channel stops, so the effect is attached each time a channel
+// is started through this module; channel settings persist like Mix_Volume,
+// and rate, bus and send settings also outlive Mix_CloseAudio.
+// The table is resized and mutated under the audio device lock.
+
+enum MixPositionCall { MIX_CALL_PANNING, MIX_CALL_POSITION, MIX_CALL_DISTANCE, MIX_CALL_REVERSE_STEREO, MIX_POSITION_CALL_COUNT };
+
+static Uint32 s_position_call_stamp = 0;
+
+#define MIX_MAX_SENDS 4 // reverb send buses
+
+struct MixChannel
+{
+	bool m_attached;
+	Mix_Chunk* m_chunk;
+	// playback rate
+	bool m_rate_enabled;
+	bool m_rate_active; // this playback is resampled
+	bool m_rate_halting;
+	Uint32 m_expire; // SDL_GetTicks() when a timed playback stops, 0 for never
+	Uint32 m_fade_out; // SDL_GetTicks() when a fade out halts the playback, 0 for none
+	bool m_halted; // halted from script
+	double m_rate;
+	double m_rate_target;
+	double m_rate_coeff; // one-pole smoothing per frame
+	double m_cursor; // source frame
+	int m_loops; // remaining, -1 forever
+	// bus
+	int m_tag; // mirrors Mix_GroupChannel
+	float m_bus_gain; // applied at the end of the last buffer
+	// automation, allocated on the main thread and kept for reuse
+	MixEnvelope* m_envelope[MIX_ENVELOPE_PARAM_COUNT];
+	// position effect calls, replayed in order when the device is reopened
+	Uint32 m_position_call[MIX_POSITION_CALL_COUNT]; // call stamp, 0 for never
+	Uint8 m_panning_left;
+	Uint8 m_panning_right;
+	Sint16 m_position_angle;
+	Uint8 m_position_distance;
+	Uint8 m_distance;
+	int m_reverse_stereo;
+	// float mix engine
+	bool m_engine; // this playback is mixed by the engine
+	Mix_Chunk* m_standin; // SDL_mixer plays it instead of m_chunk: silent for engine voices, the rest of m_chunk after a reopen; owned
+	float m_engine_volume; // channel and chunk volume at the end of the last buffer
+	float m_engine_start; // gain ramp across the current buffer
+	float m_engine_end;
+	int m_engine_run; // frames of the current buffer the voice plays
+	// reverb sends
+	float m_send[MIX_MAX_SENDS];
+	int m_send_offset; // frames of the current buffer already sent
+};
+
+static MixChannel* s_channels = NULL;
+static int s_channel_count = 0;
+static int s_channel_reserved = 0;
+static bool s_channel_rate_any = false;
+static bool s_channel_engine = false; // new plays go to the float mix engine
+
+static void _channels_resize(int count)
+{
+	SDL_LockAudio();
+	MixChannel* channels = (count > 0)?(new MixChannel[count]):(NULL);
+	for (int i = 0; i < count; ++i)
+	{
+		if (i < s_channel_count) { channels[i] = s_channels[i]; continue; }
+		SDL_zero(channels[i]);
+		channels[i].m_tag = -1;
+		channels[i].m_bus_gain = 1.0f;
+		channels[i].m_standin = new Mix_Chunk;
+		SDL_zerop(channels[i].m_standin);
+	}
+	for (int i = count; i < s_channel_count; ++i)
+	{
+		for (int p = 0; p < MIX_ENVELOPE_PARAM_COUNT; ++p) { delete s_channels[i].m_envelope[p]; }
+		delete s_channels[i].m_standin;
+	}
+	delete[] s_channels; s_channels = channels;
+	s_channel_count = count;
+	SDL_UnlockAudio();
+}
+
+static MixChannel* _channel(int channel)
+{
+	return ((channel >= 0) && (channel < s_channel_count))?(&s_channels[channel]):(NULL);
+}
+
+// resolve -1 the way Mix_PlayChannelTimed does, so channel settings can be
+// applied before the chunk starts
+static int _channel_resolve(int channel)
+{
+	if ((channel != -1) || (!s_channel_rate_any && !s_channel_engine)) { return channel; }
+	for (int i = s_channel_reserved; i < s_channel_count; ++i)
+	{
+		if (Mix_Playing(i) == 0) { return i; }
+	}
+	return channel;
+}
+
+static int _channel_play_loops(int channel, int loops)
+{
+	MixChannel* state = _channel(channel);
+	// a resampled channel runs out at a different time than SDL_mixer
+	// expects, so SDL_mixer loops forever and the effect halts the channel
+	return (state && state->m_rate_enabled)?(-1):(loops);
+}
+
+// main thread, from the audio events: halt the resampled channels that ran
+// out of source; a channel started again since then is no longer halting
+static void _channels_halt_pending(void)
+{
+	for (int i = 0; i < s_channel_count; ++i)
+	{
+		SDL_LockAudio();
+		MixChannel* state = _channel(i);
+		bool halt = state && state->m_attached && state->m_rate_halting;
+		SDL_UnlockAudio();
+		if (halt) { Mix_HaltChannel(i); }
+	}
+}
+
+// source frames converted to float a block at a time for the resampler taps
+struct MixRateSource
+{
+	enum { k_frames = 256, k_max_channels = 8 };
+	int m_start;
+	int m_count;
+	float m_pcm[k_frames * k_max_channels];
+};
+
+// the frame at index, or silence past the end of a playback that does not
+// loop; the pointer is good until the next fetch
+static const float* _channel_rate_fetch(const MixChannel* state, int frames, int channels, Sint64 index, MixRateSource* source)
+{
+	static const float k_silence[MixRateSource::k_max_channels] = { 0 };
+	if (state->m_loops != 0)
+	{
+		index %= frames; if (index < 0) { index += frames; }
+	}
+	else if ((index < 0) || (index >= frames))
+	{
+		return k_silence;
+	}
+	if ((index < source->m_start) || (index >= source->m_start + source->m_count))
+	{
+		int sample_size = SDL_AUDIO_BITSIZE(s_audio_format) / 8;
+		source->m_start = (int) index;
+		source->m_count = SDL_min((int) MixRateSource::k_frames, frames - (int) index);
+		_pcm_to_float(state->m_chunk->abuf + (index * sample_size * channels), source->m_pcm, source->m_count * channels, s_audio_format);
+	}
+	return source->m_pcm + ((index - source->m_start) * channels);
+}
+
+static void _channel_rate_process(int channel, MixChannel* state, Uint8* stream, int len)
+{
+	static const int k_block_frames = 64;
+	static const int k_max_channels = 8;
+	int channels = SDL_min(s_audio_channels, k_max_channels);
+	int frame_size = _audio_frame_size();
+	if (!state->m_chunk || (frame_size <= 0) || (channels != s_audio_channels)) { return; }
+	int frames = (int) (state->m_chunk->alen / frame_size);
+	int out_frames = len / frame_size;
+	float p[4][k_block_frames * k_max_channels];
+	float t[k_block_frames * k_max_channels];
+	float out[k_block_frames * k_max_channels];
+	MixRateSource source;
+	source.m_start = 0;
+	source.m_count = 0;
+	for (int done = 0; done < out_frames; done += k_block_frames)
+	{
+		int count = SDL_min(k_block_frames, out_frames - done);
+		for (int i = 0; i < count; ++i)
+		{
+			if (state->m_rate_halting || (frames == 0))
+			{
+				for (int c = 0; c < channels; ++c)
+				{
+					for (int k = 0; k < 4; ++k) { p[k][i * channels + c] = 0.0f; }
+					t[i * channels + c] = 0.0f;
+				}
+				continue;
+			}
+			Sint64 index = (Sint64) floor(state->m_cursor);
+			float frac = (float) (state->m_cursor - index);
+			for (int k = 0; k < 4; ++k)
+			{
+				const float* tap = _channel_rate_fetch(state, frames, channels, index - 1 + k, &source);
+				for (int c = 0; c < channels; ++c) { p[k][i * channels + c] = tap[c]; }
+			}
+			for (int c = 0; c < channels; ++c) { t[i * channels + c] = frac; }
+			state->m_rate += (state->m_rate_target - state->m_rate) * state->m_rate_coeff;
+			state->m_cursor += state->m_rate;
+			if (state->m_cursor >= frames)
+			{
+				if (state->m_loops != 0)
+				{
+					state->m_cursor -= frames;
+					if (state->m_loops > 0) { --state->m_loops; }
+				}
+				else
+				{
+					state->m_rate_halting = true;
+					_audio_event_raise(MIX_EVENT_CHANNEL_HALT);
+				}
+			}
+		}
+		_kernel_hermite(p[0], p[1], p[2], p[3], t, out, count * channels);
+		_pcm_from_float(out, stream + (done * frame_size), count * channels, s_audio_format);
+	}
+}
+
+// buses
+//
+// Every group tag can carry a bus gain, and duck rules lower target buses
+// while any channel of a source group is playing.  Rules are evaluated once
+// per mix buffer in the post effect, so they act from the next buffer; each
+// channel ramps to its bus gain across the buffer.  The music bus scales the
+// Mix_VolumeMusic setting instead: SDL_mixer mixes the music into the output
+// before the channels with no hook in between, so its gain moves once per
+// buffer in 1/128 volume steps, which step audibly under fast ducking or at
+// low music volumes.
+
+#define MIX_BUS_MUSIC (-2)
+
+struct MixBus
+{
+	bool m_used;
+	int m_tag;
+	double m_gain; // set from script
+	double m_duck; // product of the duck rules targeting this bus
+};
+
+struct MixDuckRule
+{
+	static const int k_max_targets = 8;
+	int m_id; // 0 when unused
+	int m_source;
+	int m_targets[k_max_targets];
+	int m_target_count;
+	double m_depth; // gain when fully ducked
+	double m_attack; // seconds
+	double m_release;
+	double m_level; // 0..1
+};
+
+static const int k_max_buses = 32;
+static const int k_max_duck_rules = 16;
+static MixBus s_buses[k_max_buses];
+static MixDuckRule s_duck_rules[k_max_duck_rules];
+static int s_duck_rule_next_id = 1;
+static int s_music_volume = MIX_MAX_VOLUME; // as set from script
+static int s_music_volume_applied = -1;
+
+static MixBus* _bus(int tag, bool create)
+{
+	MixBus* unused = NULL;
+	for (int i = 0; i < k_max_buses; ++i)
+	{
+		if (s_buses[i].m_used && (s_buses[i].m_tag == tag)) { return &s_buses[i]; }
+		if (!s_buses[i].m_used && !unused) { unused = &s_buses[i]; }
+	}
+	if (!create || !unused) { return NULL; }
+	unused->m_used = true;
+	unused->m_tag = tag;
+	unused->m_gain = 1.0;
+	unused->m_duck = 1.0;
+	return unused;
+}
+
+static float _bus_gain(int tag)
+{
+	MixBus* bus = _bus(tag, false);
+	return (bus)?((float) (bus->m_gain * bus->m_duck)):(1.0f);
+}
+
+static bool _bus_group_active(int tag)
+{
+	for (int i = 0; i < s_channel_count; ++i)
+	{
+		if ((s_channels[i].m_tag == tag) && Mix_Playing(i) && !Mix_Paused(i)) { return true; }
+	}
+	return false;
+}
+
+static bool _music_volume_managed(void)
+{
+	return _bus(MIX_BUS_MUSIC, false) || (s_music_envelope && s_music_envelope->m_active);
+}
+
+static void _music_volume_apply(void)
+{
+	double gain = _bus_gain(MIX_BUS_MUSIC);
+	if (s_music_envelope && s_music_envelope->m_active)
+	{
+		gain *= SDL_max(0.0, _envelope_value(s_music_envelope, s_music_envelope->m_now));
+	}
+	int volume = SDL_min((int) floor(s_music_volume * gain + 0.5), MIX_MAX_VOLUME);
+	if (volume != s_music_volume_applied)
+	{
+		s_music_volume_applied = volume;
+		Mix_VolumeMusic(volume);
+	}
+}
+
+static void _bus_update(int len)
+{
+	int frame_size = _audio_frame_size();
+	if ((frame_size <= 0) || (s_audio_frequency <= 0)) { return; }
+	double seconds = (double) (len / frame_size) / s_audio_frequency;
+	bool any = false;
+	for (int i = 0; i < k_max_buses; ++i) { s_buses[i].m_duck = 1.0; }
+	for (int r = 0; r < k_max_duck_rules; ++r)
+	{
+		MixDuckRule* rule = &s_duck_rules[r];
+		if (rule->m_id == 0) { continue; }
+		any = true;
+		double target = (_bus_group_active(rule->m_source))?(1.0):(0.0);
+		double time = (target > rule->m_level)?(rule->m_attack):(rule->m_release);
+		rule->m_level += (target - rule->m_level) * ((time > 0)?(1.0 - exp(-seconds / time)):(1.0));
+		double gain = 1.0 - rule->m_level * (1.0 - rule->m_depth);
+		for (int t = 0; t < rule->m_target_count; ++t)
+		{
+			MixBus* bus = _bus(rule->m_targets[t], false); // created with the rule
+			if (bus) { bus->m_duck *= gain; }
+		}
+	}
+	if (s_music_envelope && s_music_envelope->m_active) { _envelope_advance(s_music_envelope, seconds); }
+	if (any || _music_volume_managed()) { _music_volume_apply(); }
+}
+
+// reverb sends
+//
+// Each send bus can hold a convolution reverb.  Channels feed sends in stereo
+// at their own levels after their channel volume: SDL_mixer channels from a
+// send effect kept behind their position effects, so sends follow panning and
+// distance, engine voices from the engine pass.  The post effect pushes the
+// send input into a lock-free ring and wakes the reverb thread, which runs
+// uniformly partitioned overlap-save FFT convolution one partition at a time,
+// each input side through its side of the IR (both through a mono IR), and
+// pushes the stereo tail into a second ring.  The audio thread only
+// copies: it adds the tail once the ring holds a partition plus a buffer, and
+// re-primes after a miss, so a late worker costs a gap in the tail instead of
+// a stall in the mix.
+
+#define MIX_SEND_MAX_FRAMES 16384
+
+// single producer, single consumer float ring; the counters only grow and are
+// masked, each side publishes its counter after touching the data
+struct MixRing
+{
+	float* m_data;
+	Uint32 m_mask;
+	SDL_atomic_t m_write;
+	SDL_atomic_t m_read;
+};
+
+static void _ring_init(MixRing* ring, int capacity)
+{
+	Uint32 size = 1;
+	while (size < (Uint32) capacity) { size *= 2; }
+	ring->m_data = (float*) SDL_calloc(size, sizeof(float));
+	ring->m_mask = size - 1;
+	SDL_AtomicSet(&ring->m_write, 0);
+	SDL_AtomicSet(&ring->m_read, 0);
+}
+
+static void _ring_quit(MixRing* ring)
+{
+	SDL_free(ring->m_data); ring->m_data = NULL;
+}
+
+static int _ring_available(MixRing* ring)
+{
+	return (int) ((Uint32) SDL_AtomicGet(&ring->m_write) - (Uint32) SDL_AtomicGet(&ring->m_read));
+}
+
+static int _ring_space(MixRing* ring)
+{
+	return (int) (ring->m_mask + 1) - _ring_available(ring);
+}
+
+// all or nothing
+static bool _ring_write(MixRing* ring, const float* src, int count)
+{
+	if (_ring_space(ring) < count) { return false; }
+	Uint32 write = (Uint32) SDL_AtomicGet(&ring->m_write);
+	for (int i = 0; i < count; ++i) { ring->m_data[(write + i) & ring->m_mask] = (src)?(src[i]):(0.0f); }
+	SDL_AtomicSet(&ring->m_write, (int) (write + count));
+	return true;
+}
+
+static bool _ring_read(MixRing* ring, float* dst, int count)
+{
+	if (_ring_available(ring) < count) { return false; }
+	Uint32 read = (Uint32) SDL_AtomicGet(&ring->m_read);
+	for (int i = 0; i < count; ++i) { dst[i] = ring->m_data[(read + i) & ring->m_mask]; }
+	SDL_AtomicSet(&ring->m_read, (int) (read + count));
+	return true;
+}
+
+// in-place radix-2 complex FFT on split real and imaginary arrays
+struct MixFFT
+{
+	int m_size;
+	int* m_reverse;
+	float* m_cos; // cos(2 pi k / size), size / 2 entries
+	float* m_sin;
+};
+
+static void _fft_init(MixFFT* fft, int size)
+{
+	int bits = 0;
+	while ((1 << bits) < size) { ++bits; }
+	fft->m_size = size;
+	fft->m_reverse = new int[size];
+	fft->m_cos = new float[size / 2];
+	fft->m_sin = new float[size / 2];
+	for (int i = 0; i < size; ++i)
+	{
+		int r = 0;
+		for (int b = 0; b < bits; ++b) { if (i & (1 << b)) { r |= 1 << (bits - 1 - b); } }
+		fft->m_reverse[i] = r;
+	}
+	for (int k = 0; k < size / 2; ++k)
+	{
+		fft->m_cos[k] = (float) cos(2 * M_PI * k / size);
+		fft->m_sin[k] = (float) sin(2 * M_PI * k / size);
+	}
+}
+
+static void _fft_quit(MixFFT* fft)
+{
+	delete[] fft->m_reverse; fft->m_reverse = NULL;
+	delete[] fft->m_cos; fft->m_cos = NULL;
+	delete[] fft->m_sin; fft->m_sin = NULL;
+}
+
+// unscaled in both directions
+static void _fft(const MixFFT* fft, float* re, float* im, bool inverse)
+{
+	int n = fft->m_size;
+	for (int i = 0; i < n; ++i)
+	{
+		int j = fft->m_reverse[i];
+		if (j > i) { float t = re[i]; re[i] = re[j]; re[j] = t; t = im[i]; im[i] = im[j]; im[j] = t; }
+	}
+	float sign = (inverse)?(1.0f):(-1.0f);
+	for (int half = 1; half < n; half *= 2)
+	{
+		int stride = n / (2 * half);
+		for (int start = 0; start < n; start += 2 * half)
+		{
+			for (int k = 0; k < half; ++k)
+			{
+				float wr = fft->m_cos[k * stride], wi = sign * fft->m_sin[k * stride];
+				int a = start + k, b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr; im[b] = im[a] - ti;
+				re[a] += tr; im[a] += ti;
+			}
+		}
+	}
+}
+
+class MixReverb
+{
+public:
+	int m_partition; // frames per partition, B
+	int m_partitions; // IR partitions, P
+	int m_size; // FFT size, 2B
+	bool m_stereo; // separate left and right IR
+	float m_wet_gain[2]; // left, right
+	MixFFT m_fft;
+	float* m_ir; // P spectra of re, im (and right re, im) of size 2B each
+	float* m_fdl; // P input spectra of left re, im, right re, im, newest at m_fdl_head
+	int m_fdl_head;
+	float* m_time; // last 2B input frames, left then right
+	float* m_work; // re, im, left re, left im, right re, right im
+	int m_silent; // consecutive silent input partitions
+	MixRing m_in; // stereo send input
+	MixRing m_out; // stereo tail
+	SDL_sem* m_wake;
+	SDL_atomic_t m_quit;
+	SDL_Thread* m_thread;
+	SDL_atomic_t m_blocks; // partitions convolved
+	// audio thread, under the audio device lock
+	float* m_scratch; // stereo send input of the current buffer
+	bool m_primed;
+	int m_dropped; // input frames lost to a full ring
+	int m_missed; // buffers without a tail
+public:
+	MixReverb(const float* ir, int frames, int channels, int partition, float wet) :
+		m_partition(partition),
+		m_partitions(SDL_max(1, (frames + partition - 1) / partition)),
+		m_size(partition * 2),
+		m_stereo(channels >= 2),
+		m_ir(NULL), m_fdl(NULL), m_fdl_head(0), m_time(NULL), m_work(NULL),
+		m_silent(0),
+		m_wake(SDL_CreateSemaphore(0)),
+		m_thread(NULL),
+		m_scratch(new float[MIX_SEND_MAX_FRAMES * 2]),
+		m_primed(false),
+		m_dropped(0),
+		m_missed(0)
+	{
+		m_wet_gain[0] = wet;
+		m_wet_gain[1] = wet;
+		SDL_AtomicSet(&m_quit, 0);
+		SDL_AtomicSet(&m_blocks, 0);
+		SDL_memset(m_scratch, 0, MIX_SEND_MAX_FRAMES * 2 * sizeof(float));
+		_fft_init(&m_fft, m_size);
+		int spectra = (m_stereo)?(4):(2);
+		m_ir = new float[(size_t) m_partitions * spectra * m_size];
+		m_fdl = new float[(size_t) m_partitions * 4 * m_size];
+		m_time = new float[2 * m_size];
+		m_work = new float[6 * m_size];
+		SDL_memset(m_fdl, 0, (size_t) m_partitions * 4 * m_size * sizeof(float));
+		SDL_memset(m_time, 0, 2 * m_size * sizeof(float));
+		// each partition zero padded to 2B; the inverse FFT scale is folded in
+		for (int p = 0; p < m_partitions; ++p)
+		{
+			for (int c = 0; c < spectra / 2; ++c)
+			{
+				float* re = m_ir + ((size_t) p * spectra + c * 2) * m_size;
+				float* im = re + m_size;
+				SDL_memset(re, 0, 2 * m_size * sizeof(float));
+				for (int i = 0; (i < partition) && ((p * partition + i) < frames); ++i)
+				{
+					re[i] = ir[(p * partition + i) * channels + c] / m_size;
+				}
+				_fft(&m_fft, re, im, false);
+			}
+		}
+		int capacity = 2 * (MIX_SEND_MAX_FRAMES + partition);
+		_ring_init(&m_in, 2 * capacity);
+		_ring_init(&m_out, 2 * capacity);
+		m_thread = SDL_CreateThread(_worker, "Mix_Reverb", this);
+	}
+	~MixReverb()
+	{
+		if (m_thread)
+		{
+			SDL_AtomicSet(&m_quit, 1);
+			SDL_SemPost(m_wake);
+			SDL_WaitThread(m_thread, NULL); m_thread = NULL;
+		}
+		SDL_DestroySemaphore(m_wake); m_wake = NULL;
+		_ring_quit(&m_in);
+		_ring_quit(&m_out);
+		_fft_quit(&m_fft);
+		delete[] m_ir; m_ir = NULL;
+		delete[] m_fdl; m_fdl = NULL;
+		delete[] m_time; m_time = NULL;
+		delete[] m_work; m_work = NULL;
+		delete[] m_scratch; m_scratch = NULL;
+	}
+public:
+	// audio thread: queue the send input of this buffer and take its tail, or
+	// nothing while the tail ring is priming
+	bool Process(int frames, float* tail)
+	{
+		if (!_ring_write(&m_in, m_scratch, 2 * frames)) { m_dropped += frames; }
+		SDL_memset(m_scratch, 0, 2 * frames * sizeof(float));
+		SDL_SemPost(m_wake);
+		if (!m_primed && (_ring_available(&m_out) >= 2 * (frames + m_partition))) { m_primed = true; }
+		if (m_primed && _ring_read(&m_out, tail, 2 * frames)) { return true; }
+		if (m_primed) { m_missed++; m_primed = false; }
+		return false;
+	}
+private:
+	// in and out are b interleaved stereo frames
+	void _convolve(const float* in, float* out)
+	{
+		int n = m_size, b = m_partition;
+		float* left = m_time;
+		float* right = m_time + n;
+		SDL_memmove(left, left + b, b * sizeof(float));
+		SDL_memmove(right, right + b, b * sizeof(float));
+		bool silent = true;
+		for (int i = 0; i < b; ++i)
+		{
+			left[b + i] = in[i * 2 + 0];
+			right[b + i] = in[i * 2 + 1];
+			silent = silent && (in[i * 2 + 0] == 0.0f) && (in[i * 2 + 1] == 0.0f);
+		}
+		m_silent = (silent)?(m_silent + 1):(0);
+		m_fdl_head = (m_fdl_head + 1) % m_partitions;
+		float* xlr = m_fdl + (size_t) m_fdl_head * 4 * n;
+		float* xli = xlr + n;
+		float* xrr = xlr + 2 * n;
+		float* xri = xlr + 3 * n;
+		if (m_silent > m_partitions + 1)
+		{
+			// the whole delay line is silent: so is the tail
+			SDL_memset(xlr, 0, 4 * n * sizeof(float));
+			SDL_memset(out, 0, 2 * b * sizeof(float));
+			return;
+		}
+		float* yr = m_work;
+		float* yi = m_work + n;
+		float* lr = m_work + 2 * n;
+		float* li = m_work + 3 * n;
+		float* rr = m_work + 4 * n;
+		float* ri = m_work + 5 * n;
+		// both real inputs through one forward FFT of left + i right, split
+		// by the symmetry of real spectra
+		SDL_memcpy(yr, left, n * sizeof(float));
+		SDL_memcpy(yi, right, n * sizeof(float));
+		_fft(&m_fft, yr, yi, false);
+		for (int k = 0; k < n; ++k)
+		{
+			int j = (n - k) & (n - 1);
+			xlr[k] = 0.5f * (yr[k] + yr[j]);
+			xli[k] = 0.5f * (yi[k] - yi[j]);
+			xrr[k] = 0.5f * (yi[k] + yi[j]);
+			xri[k] = 0.5f * (yr[j] - yr[k]);
+		}
+		SDL_memset(lr, 0, 4 * n * sizeof(float));
+		int spectra = (m_stereo)?(4):(2);
+		for (int p = 0; p < m_partitions; ++p)
+		{
+			int slot = (m_fdl_head - p + m_partitions) % m_partitions;
+			const float* sl = m_fdl + (size_t) slot * 4 * n;
+			const float* sr = sl + 2 * n;
+			const float* hl = m_ir + (size_t) p * spectra * n;
+			const float* hr = (m_stereo)?(hl + 2 * n):(hl);
+			_kernel_complex_mac(sl, sl + n, hl, hl + n, lr, li, n);
+			_kernel_complex_mac(sr, sr + n, hr, hr + n, rr, ri, n);
+		}
+		// both real outputs from one inverse FFT of left + i right
+		for (int k = 0; k < n; ++k)
+		{
+			yr[k] = lr[k] - ri[k];
+			yi[k] = li[k] + rr[k];
+		}
+		_fft(&m_fft, yr, yi, true);
+		for (int i = 0; i < b; ++i)
+		{
+			out[i * 2 + 0] = yr[b + i];
+			out[i * 2 + 1] = yi[b + i];
+		}
+	}
+	static int _worker(void* data)
+	{
+		MixReverb* reverb = (MixReverb*) data;
+		int b = reverb->m_partition;
+		float* in = new float[2 * b];
+		float* out = new float[2 * b];
+		for (;;)
+		{
+			SDL_SemWait(reverb->m_wake);
+			if (SDL_AtomicGet(&reverb->m_quit)) { break; }
+			while ((_ring_available(&reverb->m_in) >= 2 * b) && (_ring_space(&reverb->m_out) >= 2 * b))
+			{
+				_ring_read(&reverb->m_in, in, 2 * b);
+				reverb->_convolve(in, out);
+				_ring_write(&reverb->m_out, out, 2 * b);
+				SDL_AtomicAdd(&reverb->m_blocks, 1);
+			}
+		}
+		delete[] in;
+		delete[] out;
+		return 0;
+	}
+};
+
+static MixReverb* s_sends[MIX_MAX_SENDS];
+static float s_send_tail[MIX_SEND_MAX_FRAMES * 2];
+static float s_send_return[MIX_SEND_MAX_FRAMES * 2];
+
+// add count frames of mono or stereo device format PCM, scaled by the left
+// and right gain times the channel's send levels, to the stereo sends at
+// offset frames
+static void _send_tap(MixChannel* state, const Uint8* src, int offset, int count, const float gain[2])
+{
+	static const int k_block_frames = 64;
+	int channels = s_audio_channels;
+	int frame_size = _audio_frame_size();
+	bool any = false;
+	for (int s = 0; s < MIX_MAX_SENDS; ++s) { any = any || (s_sends[s] && (state->m_send[s] > 0)); }
+	if (!any || ((gain[0] <= 0) && (gain[1] <= 0)) || (frame_size <= 0) || ((channels != 1) && (channels != 2))) { return; }
+	count = SDL_min(count, MIX_SEND_MAX_FRAMES - offset);
+	float block[k_block_frames * 2];
+	for (int done = 0; done < count; done += k_block_frames)
+	{
+		int n = SDL_min(k_block_frames, count - done);
+		_pcm_to_float(src + (done * frame_size), block, n * channels, s_audio_format);
+		for (int s = 0; s < MIX_MAX_SENDS; ++s)
+		{
+			if (!s_sends[s] || (state->m_send[s] <= 0)) { continue; }
+			float level[2] = { gain[0] * state->m_send[s], gain[1] * state->m_send[s] };
+			float* dst = s_sends[s]->m_scratch + ((offset + done) * 2);
+			if (channels == 2) { _kernel_mix_ramp(block, dst, n, 2, level, level); continue; }
+			// a mono device feeds both sides
+			for (int i = 0; i < n; ++i)
+			{
+				dst[i * 2 + 0] += block[i] * level[0];
+				dst[i * 2 + 1] += block[i] * level[1];
+			}
+		}
+	}
+}
+
+// post effect: run the sends for this buffer and add their tails to the mix
+static void _send_process(Uint8* stream, int len)
+{
+	static const int k_block_frames = 256;
+	for (int i = 0; i < s_channel_count; ++i) { s_channels[i].m_send_offset = 0; }
+	int channels = s_audio_channels;
+	int frame_size = _audio_frame_size();
+	if ((frame_size <= 0) || ((channels != 1) && (channels != 2))) { return; }
+	int frames = SDL_min(len / frame_size, MIX_SEND_MAX_FRAMES);
+	bool any = false;
+	for (int s = 0; s < MIX_MAX_SENDS; ++s)
+	{
+		MixReverb* reverb = s_sends[s];
+		if (!reverb || !reverb->Process(frames, s_send_tail)) { continue; }
+		if (!any) { SDL_memset(s_send_return, 0, frames * 2 * sizeof(float)); any = true; }
+		_kernel_mix_ramp(s_send_tail, s_send_return, frames, 2, &reverb->m_wet_gain[0], &reverb->m_wet_gain[0]);
+	}
+	if (!any) { return; }
+	static const float k_unity[2] = { 1.0f, 1.0f };
+	float bus[k_block_frames * 2];
+	for (int frame = 0; frame < frames; frame += k_block_frames)
+	{
+		int count = SDL_min(k_block_frames, frames - frame);
+		Uint8* data = stream + (frame * frame_size);
+		_pcm_to_float(data, bus, count * channels, s_audio_format);
+		if (channels == 2) { _kernel_mix_ramp(s_send_return + (frame * 2), bus, count, 2, k_unity, k_unity); }
+		else { for (int i = 0; i < count; ++i) { bus[i] += 0.5f * (s_send_return[(frame + i) * 2] + s_send_return[(frame + i) * 2 + 1]); } }
+		_pcm_from_float(bus, data, count * channels, s_audio_format);
+	}
+}
+
+static void _sends_quit(void)
+{
+	for (int s = 0; s < MIX_MAX_SENDS; ++s)
+	{
+		SDL_LockAudio();
+		MixReverb* reverb = s_sends[s];
+		s_sends[s] = NULL;
+		SDL_UnlockAudio();
+		delete reverb;
+	}
+}
+
+static bool _channel_envelope_active(MixChannel* state, int param)
+{
+	return state->m_envelope[param] && state->m_envelope[param]->m_active;
+}
+
+// left and right gains at both edges of count frames starting at frame, with
+// the bus gain ramped from bus_start to bus_end across a buffer of frames and
+// the envelopes evaluated from their current time
+static void _channel_edge_gains(MixEnvelope* volume, MixEnvelope* pan, float bus_start, float bus_end, int frame, int count, int frames, float g[2][2])
+{
+	double frame_seconds = 1.0 / s_audio_frequency;
+	for (int edge = 0; edge < 2; ++edge)
+	{
+		int at = frame + ((edge == 0)?(0):(count));
+		float gain = bus_start + (bus_end - bus_start) * ((float) at / frames);
+		if (volume) { gain *= (float) SDL_max(0.0, _envelope_value(volume, volume->m_now + (at - frame) * frame_seconds)); }
+		float left = gain, right = gain;
+		if (pan)
+		{
+			// balance with an equal-power law on the far side
+			double p = SDL_max(-1.0, SDL_min(_envelope_value(pan, pan->m_now + (at - frame) * frame_seconds), 1.0));
+			if (p > 0) { left *= (float) cos(p * M_PI / 2); }
+			if (p < 0) { right *= (float) cos(-p * M_PI / 2); }
+		}
+		g[edge][0] = left;
+		g[edge][1] = right;
+	}
+}
+
+static void _channel_envelopes_advance(int chan, MixEnvelope* volume, MixEnvelope* pan, int count)
+{
+	double seconds = (double) count / s_audio_frequency;
+	if (volume) { _envelope_advance(volume, seconds); }
+	if (pan) { _envelope_advance(pan, seconds); }
+}
+
+// main thread, from the audio events: report completed envelopes through
+// the channel finished callback, the music one as channel MIX_BUS_MUSIC
+static void _envelopes_done_pending(void)
+{
+	SDL_LockAudio();
+	bool music = _envelope_take_done(s_music_envelope);
+	SDL_UnlockAudio();
+	if (music) { Nanx::SimpleTask::Run(new TaskChannelFinished(MIX_BUS_MUSIC, MIX_ENVELOPE_VOLUME)); }
+	for (int i = 0; i < s_channel_count; ++i)
+	{
+		for (int param = 0; param < MIX_ENVELOPE_PARAM_COUNT; ++param)
+		{
+			SDL_LockAudio();
+			bool done = _envelope_take_done(s_channels[i].m_envelope[param]);
+			SDL_UnlockAudio();
+			if (done) { Nanx::SimpleTask::Run(new TaskChannelFinished(i, param)); }
+		}
+	}
+}
+
+// bus gain ramp, volume and pan automation in one pass over the channel
+static void _channel_gain_process(int chan, MixChannel* state, Uint8* stream, int len)
+{
+	static const int k_block_frames = 64;
+	static const int k_max_channels = 8;
+	float bus_start = state->m_bus_gain;
+	float bus_end = _bus_gain(state->m_tag);
+	state->m_bus_gain = bus_end;
+	MixEnvelope* volume = (_channel_envelope_active(state, MIX_ENVELOPE_VOLUME))?(state->m_envelope[MIX_ENVELOPE_VOLUME]):(NULL);
+	MixEnvelope* pan = (_channel_envelope_active(state, MIX_ENVELOPE_PAN) && (s_audio_channels >= 2))?(state->m_envelope[MIX_ENVELOPE_PAN]):(NULL);
+	if (!volume && !pan && (bus_start == 1.0f) && (bus_end == 1.0f)) { return; }
+	int channels = s_audio_channels;
+	int frame_size = _audio_frame_size();
+	if ((frame_size <= 0) || (channels > k_max_channels)) { return; }
+	int frames = len / frame_size;
+	if (frames <= 0) { return; }
+	float block[k_block_frames * k_max_channels];
+	for (int frame = 0; frame < frames; frame += k_block_frames)
+	{
+		int count = SDL_min(k_block_frames, frames - frame);
+		Uint8* data = stream + (frame * frame_size);
+		_pcm_to_float(data, block, count * channels, s_audio_format);
+		// gains at the block edges, ramped per frame
+		float g[2][2];
+		_channel_edge_gains(volume, pan, bus_start, bus_end, frame, count, frames, g);
+		for (int i = 0; i < count; ++i)
+		{
+			float x = (float) i / count;
+			float left = g[0][0] + (g[1][0] - g[0][0]) * x;
+			float right = g[0][1] + (g[1][1] - g[0][1]) * x;
+			float* sample = block + (i * channels);
+			if (channels == 1) { sample[0] *= left; continue; }
+			sample[0] *= left;
+			sample[1] *= right;
+			for (int c = 2; c < channels; ++c) { sample[c] *= 0.5f * (left + right); }
+		}
+		_pcm_from_float(block, data, count * channels, s_audio_format);
+		_channel_envelopes_advance(chan, volume, pan, count);
+	}
+}
+
+// chunk position and remaining loops of a channel SDL_mixer plays without
+// resampling
+static void _channel_cursor_advance(MixChannel* state, int len)
+{
+	int frame_size = _audio_frame_size();
+	if (!state->m_chunk || (frame_size <= 0)) { return; }
+	int frames = state->m_chunk->alen / frame_size;
+	state->m_cursor += len / frame_size;
+	while ((frames > 0) && (state->m_cursor >= frames))
+	{
+		state->m_cursor -= frames;
+		if (state->m_loops > 0) { --state->m_loops; }
+	}
+}
+
+static void _channel_effect(int chan, void* stream, int len, void* udata)
+{
+	MixChannel* state = _channel(chan);
+	if (!state) { return; }
+	// resumed after a reopen: the chunk volume reaches SDL_mixer through the stand-in
+	if (Mix_GetChunk(chan) == state->m_standin) { state->m_standin->volume = state->m_chunk->volume; }
+	if (state->m_rate_active) { _channel_rate_process(chan, state, (Uint8*) stream, len); }
+	else { _channel_cursor_advance(state, len); }
+	_channel_gain_process(chan, state, (Uint8*) stream, len);
+}
+
+// registered behind the channel effect and kept behind SDL_mixer's position
+// effects, so sends hear the channel panned and attenuated
+static void _channel_send_effect(int chan, void* stream, int len, void* udata)
+{
+	MixChannel* state = _channel(chan);
+	int frame_size = _audio_frame_size();
+	if (!state || !state->m_chunk || (frame_size <= 0)) { return; }
+	// SDL_mixer applies the channel and chunk volume after the effects
+	float volume = (float) (Mix_Volume(chan, -1) * state->m_chunk->volume) / (MIX_MAX_VOLUME * MIX_MAX_VOLUME);
+	float gain[2] = { volume, volume };
+	_send_tap(state, (Uint8*) stream, state->m_send_offset, len / frame_size, gain);
+	state->m_send_offset += len / frame_size;
+}
+
+static void _channel_effect_done(int chan, void* udata)
+{
+	MixChannel* state = _channel(chan);
+	if (!state) { return; }
+	state->m_attached = false;
+	state->m_fade_out = 0;
+	state->m_halted = false;
+	state->m_chunk = NULL;
+	state->m_rate_active = false;
+	state->m_rate_halting = false;
+	state->m_engine = false;
+	for (int p = 0; p < MIX_ENVELOPE_PARAM_COUNT; ++p)
+	{
+		if (state->m_envelope[p]) { state->m_envelope[p]->m_active = false; }
+	}
+	// SDL_mixer drops the position effects along with this one
+	for (int call = 0; call < MIX_POSITION_CALL_COUNT; ++call) { state->m_position_call[call] = 0; }
+}
+
+// Mix_CloseAudio dropped SDL_mixer's channels along with their groups and
+// position effects; rate, bus and send settings stay in the table for the
+// next Mix_OpenAudio
+static void _channels_close(void)
+{
+	SDL_LockAudio();
+	for (int i = 0; i < s_channel_count; ++i) { _channel_effect_done(i, NULL); }
+	SDL_UnlockAudio();
+}
+
+// after the device opens: size the table to SDL_mixer's channels and give
+// SDL_mixer back the groups the kept channels were in
+static void _channels_open(void)
+{
+	_channels_resize(Mix_AllocateChannels(-1));
+	for (int i = 0; i < s_channel_count; ++i)
+	{
+		if (s_channels[i].m_tag != -1) { Mix_GroupChannel(i, s_channels[i].m_tag); }
+	}
+}
+
+// called with the audio device locked, right after a successful play;
+// engine playbacks get no channel effect, the post effect mixes them
+static void _channel_attach(int channel, Mix_Chunk* chunk, int loops, bool engine)
+{
+	MixChannel* state = _channel(channel);
+	if (!state || !chunk) { return; }
+	if (state->m_attached && !state->m_engine)
+	{
+		Mix_UnregisterEffect(channel, _channel_send_effect);
+		Mix_UnregisterEffect(channel, _channel_effect);
+	}
+	state->m_attached = true;
+	state->m_chunk = chunk;
+	state->m_rate_active = state->m_rate_enabled && !engine;
+	state->m_rate_halting = false;
+	state->m_fade_out = 0;
+	state->m_halted = false;
+	state->m_rate = state->m_rate_target;
+	state->m_cursor = 0;
+	state->m_loops = loops;
+	state->m_bus_gain = _bus_gain(state->m_tag);
+	state->m_engine = engine;
+	state->m_engine_volume = (float) (Mix_Volume(channel, -1) * chunk->volume) / (MIX_MAX_VOLUME * MIX_MAX_VOLUME);
+	if (!engine)
+	{
+		Mix_RegisterEffect(channel, _channel_effect, _channel_effect_done, NULL);
+		Mix_RegisterEffect(channel, _channel_send_effect, NULL, NULL);
+	}
+}
+
+// SDL_mixer appends a position effect when it is first set on a channel:
+// move the send effect back behind it
+static void _channel_send_last(int channel)
+{
+	SDL_LockAudio();
+	MixChannel* state = _channel(channel);
+	bool attached = state && state->m_attached && !state->m_engine;
+	SDL_UnlockAudio();
+	if (!attached) { return; }
+	Mix_UnregisterEffect(channel, _channel_send_effect);
+	Mix_RegisterEffect(channel, _channel_send_effect, NULL, NULL);
+}
+
+// the float mix engine takes plain playbacks: no resampling and no
+// SDL_mixer position effects, which would run on the silent stand-in
+static bool _channel_engine_accepts(MixChannel* state)
+{
+	if (!s_channel_engine || !state || state->m_rate_enabled) { return false; }
+	if ((s_audio_channels != 1) && (s_audio_channels != 2)) { return false; }
+	for (int call = 0; call < MIX_POSITION_CALL_COUNT; ++call)
+	{
+		if (state->m_position_call[call] != 0) { return false; }
+	}
+	return true;
+}
+
+// the silent stand-in SDL_mixer plays for an engine voice; same length, so
+// SDL_mixer keeps time, loops and fades for the voice.  A reopen resumes
+// other channels through it as well, with the chunk volume
+static Mix_Chunk* _channel_standin(MixChannel* state, Mix_Chunk* chunk)
+{
+	Mix_Chunk* play = state->m_standin;
+	play->allocated = 0;
+	play->abuf = chunk->abuf;
+	play->alen = chunk->alen;
+	play->volume = 0;
+	return play;
+}
+
+// SDL_mixer position effects would run on the silent stand-in of an engine
+// voice, so they are refused while one plays
+static bool _channel_position_refused(int channel)
+{
+	SDL_LockAudio();
+	MixChannel* state = _channel(channel);
+	bool engine = state && state->m_attached && state->m_engine;
+	SDL_UnlockAudio();
+	if (engine) { Mix_SetError("Channel %d is mixed by the float mix engine", channel); }
+	return engine;
+}
+
+// start a chunk on a channel with the native channel effect attached;
+// fade_ms < 0 plays without a fade
+static int _channel_play(int channel, Mix_Chunk* chunk, int loops, int fade_ms, int ticks)
+{
+	SDL_LockAudio();
+	channel = _channel_resolve(channel);
+	int sdl_loops = _channel_play_loops(channel, loops);
+	MixChannel* state = _channel(channel);
+	bool engine = chunk && _channel_engine_accepts(state);
+	Mix_Chunk* play = (engine)?(_channel_standin(state, chunk)):(chunk);
+	int err = (fade_ms < 0)?(Mix_PlayChannelTimed(channel, play, sdl_loops, ticks)):(Mix_FadeInChannelTimed(channel, play, sdl_loops, fade_ms, ticks));
+	_channel_attach(err, chunk, loops, engine);
+	if (_channel(err)) { _channel(err)->m_expire = (ticks >= 0)?(SDL_max(SDL_GetTicks() + ticks, 1u)):(0); }
+	SDL_UnlockAudio();
+	return err;
+}
+
+// float mix engine
+//
+// With the engine on, plain playbacks started through this module are mixed
+// here instead of by SDL_mixer.  SDL_mixer plays a silent stand-in of the
+// same length on the channel, so loops, fades, expiry, pause, halt, groups
+// and the finished callback keep their usual behaviour, and SDL_mixer skips
+// the voice because its volume is 0.  The post effect then reads what
+// SDL_mixer mixed (music and the other channels) into a float bus, adds every
+// engine voice with its channel and chunk volume, bus gain, envelopes and pan
+// in one pass, and converts the bus to the device format once, optionally
+// with TPDF dither.
+
+#define MIX_ENGINE_BLOCK_FRAMES 256
+
+struct MixEngineStats
+{
+	bool m_dither;
+	Uint32 m_seed; // dither noise
+	int m_voices; // engine voices in the last buffer
+	int m_voices_peak;
+	Uint32 m_buffers; // buffers with engine voices
+};
+
+static MixEngineStats s_engine = { false, 0x9e3779b9, 0, 0, 0 };
+
+// TPDF dither of lsb peak amplitude from two uniform draws per sample
+static void _engine_dither(float* buf, int count, float lsb, Uint32* seed)
+{
+	Uint32 s = *seed;
+	for (int i = 0; i < count; ++i)
+	{
+		s ^= s << 13; s ^= s >> 17; s ^= s << 5;
+		Uint32 a = s;
+		s ^= s << 13; s ^= s >> 17; s ^= s << 5;
+		buf[i] += (((float) a - (float) s) / 4294967296.0f) * lsb;
+	}
+	*seed = s;
+}
+
+// add count frames of PCM at src to the bus, ramping the gains from g0 to g1
+static void _engine_voice_mix(const Uint8* src, ::Uint16 format, int channels, float* bus, int count, const float* g0, const float* g1)
+{
+	if (format == AUDIO_F32SYS) { _kernel_mix_ramp((const float*) src, bus, count, channels, g0, g1); return; }
+	float block[MIX_ENGINE_BLOCK_FRAMES * 2];
+	_pcm_to_float(src, block, count * channels, format);
+	_kernel_mix_ramp(block, bus, count, channels, g0, g1);
+}
+
+// mix count frames of a voice from its cursor, wrapping at the chunk end while
+// loops remain, and feed its sends; g holds the gains at the edges of the
+// count frames, which start at offset in the buffer
+static void _engine_voice_run(MixChannel* state, float* bus, int offset, int count, const float g[2][2])
+{
+	int channels = s_audio_channels;
+	int frame_size = _audio_frame_size();
+	int frames = (int) (state->m_chunk->alen / frame_size);
+	int done = 0;
+	while (done < count)
+	{
+		int cursor = (int) state->m_cursor;
+		int run = SDL_min(count - done, frames - cursor);
+		float a[2], b[2];
+		for (int c = 0; c < 2; ++c)
+		{
+			a[c] = g[0][c] + (g[1][c] - g[0][c]) * ((float) done / count);
+			b[c] = g[0][c] + (g[1][c] - g[0][c]) * ((float) (done + run) / count);
+		}
+		const Uint8* src = state->m_chunk->abuf + (cursor * frame_size);
+		_engine_voice_mix(src, s_audio_format, channels, bus + (done * channels), run, a, b);
+		// a mono device mixes the voice with the left gain
+		float gain[2] = { 0.5f * (a[0] + b[0]), 0.5f * (a[1] + b[1]) };
+		if (channels == 1) { gain[1] = gain[0]; }
+		_send_tap(state, src, offset + done, run, gain);
+		done += run;
+		state->m_cursor = cursor + run;
+		if (state->m_cursor < frames) { continue; }
+		if (state->m_loops == 0) { break; }
+		state->m_cursor = 0;
+		if (state->m_loops > 0) { --state->m_loops; }
+	}
+}
+
+static void _engine_process(Uint8* stream, int len)
+{
+	int channels = s_audio_channels;
+	int frame_size = _audio_frame_size();
+	if ((frame_size <= 0) || (s_audio_frequency <= 0) || ((channels != 1) && (channels != 2))) { return; }
+	int frames = len / frame_size;
+	int voices = 0;
+	for (int i = 0; i < s_channel_count; ++i)
+	{
+		MixChannel* state = &s_channels[i];
+		state->m_engine_run = 0;
+		if (!state->m_attached || !state->m_engine || Mix_Paused(i)) { continue; }
+		int chunk_frames = (int) (state->m_chunk->alen / frame_size);
+		if ((Mix_Playing(i) == 0) || (Mix_GetChunk(i) != state->m_standin))
+		{
+			// SDL_mixer let go of the stand-in during this buffer: at its natural
+			// end the tail is still due; a halt, fade out or expiry stops the
+			// stand-in before SDL_mixer mixes the buffer, so the voice stops at
+			// its first frame
+			Uint32 now = SDL_GetTicks();
+			bool expired = (state->m_expire != 0) && ((Sint32) (now - state->m_expire) >= 0);
+			bool faded = (state->m_fade_out != 0) && ((Sint32) (now - state->m_fade_out) >= 0);
+			int remaining = chunk_frames - (int) state->m_cursor;
+			if (!state->m_halted && !expired && !faded && (state->m_loops == 0) && (remaining > 0) && (remaining < frames))
+			{
+				state->m_engine_run = remaining;
+				state->m_engine_start = state->m_engine_volume * state->m_bus_gain;
+				state->m_engine_end = state->m_engine_start;
+				++voices;
+			}
+			else
+			{
+				_channel_effect_done(i, NULL);
+			}
+			continue;
+		}
+		float volume = (float) (Mix_Volume(i, -1) * state->m_chunk->volume) / (MIX_MAX_VOLUME * MIX_MAX_VOLUME);
+		float bus_end = _bus_gain(state->m_tag);
+		state->m_engine_start = state->m_engine_volume * state->m_bus_gain;
+		state->m_engine_end = volume * bus_end;
+		state->m_engine_volume = volume;
+		state->m_bus_gain = bus_end;
+		state->m_engine_run = (chunk_frames > 0)?(frames):(0);
+		++voices;
+	}
+	s_engine.m_voices = voices;
+	if (voices == 0) { return; }
+	s_engine.m_voices_peak = SDL_max(s_engine.m_voices_peak, voices);
+	s_engine.m_buffers++;
+	bool dither = s_engine.m_dither && !SDL_AUDIO_ISFLOAT(s_audio_format);
+	float lsb = 1.0f / (float) (1 << (SDL_AUDIO_BITSIZE(s_audio_format) - 1));
+	float bus[MIX_ENGINE_BLOCK_FRAMES * 2];
+	for (int frame = 0; frame < frames; frame += MIX_ENGINE_BLOCK_FRAMES)
+	{
+		int count = SDL_min(MIX_ENGINE_BLOCK_FRAMES, frames - frame);
+		Uint8* data = stream + (frame * frame_size);
+		_pcm_to_float(data, bus, count * channels, s_audio_format);
+		for (int i = 0; i < s_channel_count; ++i)
+		{
+			MixChannel* state = &s_channels[i];
+			int run = SDL_min(count, state->m_engine_run - frame);
+			if (run <= 0) { continue; }
+			MixEnvelope* volume = (_channel_envelope_active(state, MIX_ENVELOPE_VOLUME))?(state->m_envelope[MIX_ENVELOPE_VOLUME]):(NULL);
+			MixEnvelope* pan = (_channel_envelope_active(state, MIX_ENVELOPE_PAN) && (channels == 2))?(state->m_envelope[MIX_ENVELOPE_PAN]):(NULL);
+			float g[2][2];
+			_channel_edge_gains(volume, pan, state->m_engine_start, state->m_engine_end, frame, run, frames, g);
+			_engine_voice_run(state, bus, frame, run, g);
+			_channel_envelopes_advance(i, volume, pan, run);
+		}
+		if (dither) { _engine_dither(bus, count * channels, lsb, &s_engine.m_seed); }
+		_pcm_from_float(bus, data, count * channels, s_audio_format);
+	}
+	for (int i = 0; i < s_channel_count; ++i)
+	{
+		MixChannel* state = &s_channels[i];
+		if (state->m_attached && state->m_engine && (Mix_Playing(i) == 0)) { _channel_effect_done(i, NULL); }
+	}
+}
+
+// SDL_mixer halts the channels playing a chunk it frees, but engine voices
+// play a stand-in: halt them before the PCM goes away
+static void _engine_forget(Mix_Chunk* chunk)
+{
+	SDL_LockAudio();
+	for (int i = 0; i < s_channel_count; ++i)
+	{
+		MixChannel* state = &s_channels[i];
+		if (state->m_attached && state->m_engine && (state->m_chunk == chunk))
+		{
+			Mix_HaltChannel(i);
+			_channel_effect_done(i, NULL);
+		}
+	}
+	SDL_UnlockAudio();
+}
+
+void WrapChunk::Free(Mix_Chunk* chunk)
+{
+	if (chunk) { _engine_forget(chunk); Mix_FreeChunk(chunk); chunk = NULL; }
+}
+
+WrapChunk* WrapChunk::s_wraps = NULL;
+bool WrapChunk::s_lock_pcm = false;
+
+void WrapChunk::Link()
+{
+	m_next = s_wraps;
+	if (s_wraps) { s_wraps->m_prev = this; }
+	s_wraps = this;
+	if (s_lock_pcm) { Lock(true); }
+}
+
+void WrapChunk::Unlink()
+{
+	Lock(false);
+	if (m_prev) { m_prev->m_next = m_next; } else if (s_wraps == this) { s_wraps = m_next; }
+	if (m_next) { m_next->m_prev = m_prev; }
+	m_prev = m_next = NULL;
+}
+
+// returns 0 or errno
+int WrapChunk::Lock(bool lock)
+{
+	#if defined(__linux__)
+	if (!m_chunk || !m_chunk->abuf || (m_chunk->alen == 0) || (m_locked == lock)) { return 0; }
+	if (lock)
+	{
+		if (mlock(m_chunk->abuf, m_chunk->alen) != 0) { return errno; }
+		m_locked = true;
+		return 0;
+	}
+	// locks do not nest: unlock only the pages the PCM covers whole, as the
+	// edge pages may hold another chunk in the same arena slab
+	uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+	uintptr_t start = ((uintptr_t) m_chunk->abuf + page - 1) & ~(page - 1);
+	uintptr_t end = ((uintptr_t) m_chunk->abuf + m_chunk->alen) & ~(page - 1);
+	if (end > start) { munlock((void*) start, end - start); }
+	m_locked = false;
+	return 0;
+	#else
+	return (lock)?(ENOSYS):(0);
+	#endif
+}
+
+size_t WrapChunk::LockAll(bool lock, int* error)
+{
+	s_lock_pcm = lock;
+	size_t bytes = 0;
+	*error = 0;
+	for (WrapChunk* wrap = s_wraps; wrap; wrap = wrap->m_next)
+	{
+		int err = wrap->Lock(lock);
+		if (err != 0) { *error = err; }
+		if (wrap->m_locked) { bytes += wrap->m_chunk->alen; }
+	}
+	return bytes;
+}
+
+// playback clock
+//
+// The post effect publishes the device frame count, the music position and
+// the chunk position of every attached channel into a static block that
+// script maps as a SharedArrayBuffer.  Readers never lock: writers bump
+// m_sequence to odd before writing and back to even after, and a reader
+// retries while it is odd or changed across the read.  Writers are serialized
+// by the audio device lock.  Positions are taken at the end of the last mix
+// buffer, which is heard roughly m_buffer_frames plus device latency later.
+// The music position wraps at the track length when the length is known:
+// from SDL_mixer 2.6 and later, or from Mix_SetMusicLength.
+
+#define MIX_CLOCK_MAX_CHANNELS 256
+
+enum MixClockIndex // Float64Array indices
+{
+	MIX_CLOCK_TIME = 1,
+	MIX_CLOCK_FREQUENCY,
+	MIX_CLOCK_FRAMES,
+	MIX_CLOCK_BUFFER_FRAMES,
+	MIX_CLOCK_MUSIC_POSITION,
+	MIX_CLOCK_MUSIC_PLAYING,
+	MIX_CLOCK_CHANNEL_POSITION
+};
+
+struct MixClock
+{
+	SDL_atomic_t m_sequence; // Int32Array index 0
+	Sint32 m_channel_count; // Int32Array index 1
+	double m_time; // uv_hrtime() at the last mix buffer, ms
+	double m_frequency;
+	double m_frames; // device frames mixed since Mix_OpenAudio
+	double m_buffer_frames; // frames in the last mix buffer
+	double m_music_position; // seconds, -1 when unknown
+	double m_music_playing; // 1 while music plays and is not paused
+	double m_channel_position[MIX_CLOCK_MAX_CHANNELS]; // seconds, -1 when idle
+};
+
+SDL_COMPILE_TIME_ASSERT(mix_clock_time, offsetof(MixClock, m_time) == MIX_CLOCK_TIME * sizeof(double));
+SDL_COMPILE_TIME_ASSERT(mix_clock_channel, offsetof(MixClock, m_channel_position) == MIX_CLOCK_CHANNEL_POSITION * sizeof(double));
+
+static MixClock s_clock;
+static double s_clock_music_length = 0; // seconds, 0 when unknown
+
+static void _clock_begin(void) { SDL_AtomicAdd(&s_clock.m_sequence, 1); }
+static void _clock_end(void) { SDL_AtomicAdd(&s_clock.m_sequence, 1); }
+
+static void _clock_reset(void)
+{
+	SDL_LockAudio();
+	_clock_begin();
+	s_clock.m_channel_count = 0;
+	s_clock.m_time = 0;
+	s_clock.m_frequency = s_audio_frequency;
+	s_clock.m_frames = 0;
+	s_clock.m_buffer_frames = 0;
+	s_clock.m_music_position = 0;
+	s_clock.m_music_playing = 0;
+	for (int i = 0; i < MIX_CLOCK_MAX_CHANNELS; ++i) { s_clock.m_channel_position[i] = -1; }
+	_clock_end();
+	SDL_UnlockAudio();
+}
+
+static void _clock_update(int len)
+{
+	int frame_size = _audio_frame_size();
+	if ((frame_size <= 0) || (s_audio_frequency <= 0)) { return; }
+	int frames = len / frame_size;
+	bool music = (Mix_PlayingMusic() != 0) && (Mix_PausedMusic() == 0);
+	int count = SDL_min(s_channel_count, MIX_CLOCK_MAX_CHANNELS);
+	_clock_begin();
+	s_clock.m_channel_count = count;
+	s_clock.m_time = uv_hrtime() / 1e6;
+	s_clock.m_frequency = s_audio_frequency;
+	s_clock.m_frames += frames;
+	s_clock.m_buffer_frames = frames;
+	if (music && (s_clock.m_music_position >= 0))
+	{
+		s_clock.m_music_position += (double) frames / s_audio_frequency;
+		// still playing past the end, so the music looped
+		if ((s_clock_music_length > 0) && (s_clock.m_music_position >= s_clock_music_length))
+		{
+			s_clock.m_music_position = fmod(s_clock.m_music_position, s_clock_music_length);
+		}
+	}
+	s_clock.m_music_playing = (music)?(1):(0);
+	for (int i = 0; i < count; ++i)
+	{
+		MixChannel* state = &s_channels[i];
+		s_clock.m_channel_position[i] = (state->m_attached)?(state->m_cursor / s_audio_frequency):(-1);
+	}
+	for (int i = count; i < MIX_CLOCK_MAX_CHANNELS; ++i) { s_clock.m_channel_position[i] = -1; }
+	_clock_end();
+}
+
+// called with the audio device locked after a successful play or seek;
+// MOD positions are pattern numbers, so only a restart is tracked for them
+static void _clock_music_seek(Mix_Music* music, double position)
+{
+	Mix_MusicType type = Mix_GetMusicType(music);
+	bool seconds = (type != MUS_MOD) && (type != MUS_MODPLUG);
+	if (music)
+	{
+		#if SDL_VERSIONNUM(SDL_MIXER_MAJOR_VERSION, SDL_MIXER_MINOR_VERSION, SDL_MIXER_PATCHLEVEL) >= SDL_VERSIONNUM(2, 6, 0)
+		s_clock_music_length = SDL_max(0.0, Mix_MusicDuration(music));
+		#else
+		s_clock_music_length = 0; // until Mix_SetMusicLength
+		#endif
+	}
+	_clock_begin();
+	s_clock.m_music_position = (seconds || (position == 0))?(position):(-1);
+	_clock_end();
+}
+
+// adaptive buffer
+//
+// The post effect counts late callbacks (see audio thread) over windows of
+// mixed audio.  A window with enough late callbacks doubles the device
+// buffer; a run of clean windows halves it while the latency is above the
+// target.  The audio thread only proposes a size, through an audio event: the
+// device is reopened on the main thread with channel, music and position
+// effect state carried over.  Every decision is reported to the adaptive
+// callback and kept for Mix_GetAdaptiveBufferStats; a buffer already at the
+// maximum reports the limit once until a window passes without late callbacks.
+
+enum MixAdaptiveReason { MIX_ADAPTIVE_UNDERRUN, MIX_ADAPTIVE_TARGET, MIX_ADAPTIVE_LIMIT };
+
+struct MixAdaptiveDecision
+{
+	int m_reason;
+	int m_from; // frames
+	int m_to;
+	Uint32 m_late; // late callbacks in the window
+	Uint32 m_callbacks;
+	bool m_applied;
+};
+
+struct MixAdaptive
+{
+	bool m_enabled;
+	int m_min; // frames, powers of two
+	int m_max;
+	double m_target; // ms, 0 for none
+	double m_window; // seconds of mixed audio per decision
+	int m_grow; // late callbacks per window that grow the buffer
+	int m_stable; // clean windows before the buffer shrinks
+	// audio thread, under the audio device lock
+	bool m_pending; // m_proposal waits for the main thread
+	MixAdaptiveDecision m_proposal;
+	bool m_limited; // the limit was reported for this run of late windows
+	double m_elapsed;
+	Uint32 m_late_mark;
+	Uint32 m_callback_mark;
+	int m_clean;
+	// main thread
+	int m_grows;
+	int m_shrinks;
+	int m_failures;
+	int m_decisions;
+	MixAdaptiveDecision m_last;
+};
+
+static MixAdaptive s_adaptive;
+static Nan::Persistent<Function> s_adaptive_callback;
+
+// music started through this module, for restoring it after a reopen
+static Mix_Music* s_music_current = NULL;
+static int s_music_loops = 0;
+
+static void _adaptive_reset(void)
+{
+	s_adaptive.m_pending = false;
+	s_adaptive.m_elapsed = 0;
+	s_adaptive.m_late_mark = s_audio_thread.m_late;
+	s_adaptive.m_callback_mark = s_audio_thread.m_callbacks;
+}
+
+static void _adaptive_quit(void)
+{
+	s_adaptive.m_enabled = false;
+	s_adaptive_callback.Reset();
+}
+
+// replay a channel's position effect calls in their original order
+static void _channel_position_replay(int channel)
+{
+	MixChannel* state = _channel(channel);
+	if (!state) { return; }
+	Uint32 done = 0;
+	for (;;)
+	{
+		int next = -1;
+		for (int call = 0; call < MIX_POSITION_CALL_COUNT; ++call)
+		{
+			Uint32 stamp = state->m_position_call[call];
+			if ((stamp > done) && ((next < 0) || (stamp < state->m_position_call[next]))) { next = call; }
+		}
+		if (next < 0) { break; }
+		done = state->m_position_call[next];
+		switch (next)
+		{
+		case MIX_CALL_PANNING: Mix_SetPanning(channel, state->m_panning_left, state->m_panning_right); break;
+		case MIX_CALL_POSITION: Mix_SetPosition(channel, state->m_position_angle, state->m_position_distance); break;
+		case MIX_CALL_DISTANCE: Mix_SetDistance(channel, state->m_distance); break;
+		case MIX_CALL_REVERSE_STEREO: Mix_SetReverseStereo(channel, state->m_reverse_stereo); break;
+		}
+	}
+	if (done > 0) { _channel_send_last(channel); }
+}
+
+struct MixChannelRestore
+{
+	Mix_Chunk* m_chunk; // NULL when idle
+	bool m_rate_active;
+	bool m_engine;
+	double m_cursor;
+	double m_rate;
+	int m_loops;
+	Uint32 m_expire;
+	bool m_paused;
+	int m_volume;
+	bool m_envelope[MIX_ENVELOPE_PARAM_COUNT];
+	Uint32 m_position_call[MIX_POSITION_CALL_COUNT];
+};
+
+// close and reopen the device with another buffer size, falling back to the
+// previous size; channels continue from their saved position with their
+// remaining loops and time, resampled ones at their saved rate and engine
+// voices on the engine; the clock keeps counting
+static bool _audio_reopen(int chunksize, int previous)
+{
+	int frequency = 0;
+	::Uint16 format = 0;
+	int channels = 0;
+	int opened = Mix_QuerySpec(&frequency, &format, &channels);
+	if (opened <= 0) { return false; }
+	int count = s_channel_count;
+	MixChannelRestore* restore = new MixChannelRestore[SDL_max(count, 1)];
+	SDL_LockAudio();
+	for (int i = 0; i < count; ++i)
+	{
+		MixChannel* state = &s_channels[i];
+		MixChannelRestore* saved = &restore[i];
+		bool playing = state->m_attached && !state->m_rate_halting && (Mix_Playing(i) != 0);
+		saved->m_chunk = (playing)?(state->m_chunk):(NULL);
+		saved->m_rate_active = state->m_rate_active;
+		saved->m_engine = state->m_engine;
+		saved->m_cursor = state->m_cursor;
+		saved->m_rate = state->m_rate;
+		saved->m_loops = state->m_loops;
+		saved->m_expire = state->m_expire;
+		saved->m_paused = (Mix_Paused(i) != 0);
+		saved->m_volume = Mix_Volume(i, -1);
+		for (int p = 0; p < MIX_ENVELOPE_PARAM_COUNT; ++p) { saved->m_envelope[p] = _channel_envelope_active(state, p); }
+		// the close drops the position effects, and their stamps with them
+		for (int call = 0; call < MIX_POSITION_CALL_COUNT; ++call) { saved->m_position_call[call] = state->m_position_call[call]; }
+	}
+	Mix_Music* music = (Mix_PlayingMusic() != 0)?(s_music_current):(NULL);
+	bool music_paused = (Mix_PausedMusic() != 0);
+	double music_position = s_clock.m_music_position;
+	SDL_UnlockAudio();
+	// halting for the close is not the channels or the music finishing
+	Mix_ChannelFinished(NULL);
+	Mix_HookMusicFinished(NULL);
+	for (int i = 0; i < opened; ++i) { Mix_CloseAudio(); }
+	bool ok = (Mix_OpenAudio(frequency, format, channels, chunksize) == 0);
+	if (ok || (Mix_OpenAudio(frequency, format, channels, previous) == 0))
+	{
+		for (int i = 1; i < opened; ++i) { Mix_OpenAudio(frequency, format, channels, chunksize); }
+		Mix_AllocateChannels(count);
+		Mix_ReserveChannels(s_channel_reserved);
+		_post_effect_init(false);
+		SDL_LockAudio();
+		Uint32 now = SDL_GetTicks();
+		for (int i = 0; i < count; ++i)
+		{
+			MixChannel* state = &s_channels[i];
+			MixChannelRestore* saved = &restore[i];
+			Mix_GroupChannel(i, state->m_tag);
+			Mix_Volume(i, saved->m_volume);
+			for (int p = 0; p < MIX_ENVELOPE_PARAM_COUNT; ++p)
+			{
+				if (state->m_envelope[p]) { state->m_envelope[p]->m_active = saved->m_envelope[p]; }
+			}
+			int ticks = -1;
+			if (saved->m_expire != 0)
+			{
+				if ((Sint32) (saved->m_expire - now) <= 0) { saved->m_chunk = NULL; } // ran out while closed
+				else { ticks = (int) (saved->m_expire - now); }
+			}
+			bool played = false;
+			if (saved->m_chunk && saved->m_rate_active)
+			{
+				played = (Mix_PlayChannelTimed(i, saved->m_chunk, -1, ticks) == i);
+				if (played)
+				{
+					_channel_attach(i, saved->m_chunk, saved->m_loops, false);
+					state->m_rate_active = true;
+					state->m_rate = saved->m_rate;
+					state->m_cursor = saved->m_cursor;
+				}
+			}
+			else if (saved->m_chunk)
+			{
+				// SDL_mixer takes the first pass from the stand-in at the cursor,
+				// then restarts loops from its abuf, which goes back to the start
+				int frame_size = _audio_frame_size();
+				Uint32 frames = (frame_size > 0)?(saved->m_chunk->alen / frame_size):(0);
+				Uint32 cursor = (saved->m_cursor < frames)?((Uint32) saved->m_cursor):(0);
+				Mix_Chunk* play = _channel_standin(state, saved->m_chunk);
+				play->abuf += cursor * frame_size;
+				play->alen -= cursor * frame_size;
+				play->volume = (saved->m_engine)?(0):(saved->m_chunk->volume);
+				played = (Mix_PlayChannelTimed(i, play, saved->m_loops, ticks) == i);
+				play->abuf = saved->m_chunk->abuf;
+				play->alen = saved->m_chunk->alen;
+				if (played)
+				{
+					_channel_attach(i, saved->m_chunk, saved->m_loops, saved->m_engine);
+					state->m_rate_active = false;
+					state->m_cursor = cursor;
+				}
+			}
+			if (played)
+			{
+				state->m_expire = saved->m_expire;
+				if (saved->m_paused) { Mix_Pause(i); }
+			}
+			for (int call = 0; call < MIX_POSITION_CALL_COUNT; ++call) { state->m_position_call[call] = saved->m_position_call[call]; }
+			_channel_position_replay(i);
+		}
+		if (music)
+		{
+			// unseekable music, such as a stream, carries on from its decoder
+			int err = (music_position > 0)?(Mix_FadeInMusicPos(music, s_music_loops, 0, music_position)):(-1);
+			if (err != 0) { err = Mix_PlayMusic(music, s_music_loops); }
+			if (err == 0) { _clock_music_seek(music, music_position); }
+			if (music_paused) { Mix_PauseMusic(); }
+		}
+		SDL_UnlockAudio();
+	}
+	else
+	{
+		_post_effect_quit();
+	}
+	_channel_finished_init();
+	_music_finished_init();
+	delete[] restore;
+	return ok;
+}
+
+static Local<Object> _adaptive_decision_object(const MixAdaptiveDecision& decision)
+{
+	Nan::EscapableHandleScope scope;
+	Local<Object> result = Nan::New<Object>();
+	double frequency = SDL_max(s_audio_frequency, 1);
+	result->Set(NANX_SYMBOL("reason"), Nan::New(decision.m_reason));
+	result->Set(NANX_SYMBOL("from"), Nan::New(decision.m_from));
+	result->Set(NANX_SYMBOL("to"), Nan::New(decision.m_to));
+	result->Set(NANX_SYMBOL("latencyMs"), Nan::New(decision.m_to * 1000.0 / frequency));
+	result->Set(NANX_SYMBOL("late"), Nan::New(decision.m_late));
+	result->Set(NANX_SYMBOL("callbacks"), Nan::New(decision.m_callbacks));
+	result->Set(NANX_SYMBOL("applied"), Nan::New(decision.m_applied));
+	return scope.Escape(result);
+}
+
+// main thread, from the audio events: apply the proposed decision
+static void _adaptive_pending(void)
+{
+	SDL_LockAudio();
+	bool pending = s_adaptive.m_pending;
+	MixAdaptiveDecision decision = s_adaptive.m_proposal;
+	SDL_UnlockAudio();
+	if (!pending) { return; }
+	if (s_adaptive.m_enabled && (decision.m_to != decision.m_from))
+	{
+		decision.m_applied = _audio_reopen(decision.m_to, decision.m_from);
+		if (!decision.m_applied) { s_adaptive.m_failures++; }
+		else if (decision.m_to > decision.m_from) { s_adaptive.m_grows++; }
+		else { s_adaptive.m_shrinks++; }
+	}
+	SDL_LockAudio();
+	if (decision.m_to != decision.m_from)
+	{
+		_adaptive_reset();
+		// a grown buffer has to stay clean twice as long before it shrinks
+		if (decision.m_applied && (decision.m_to > decision.m_from)) { s_adaptive.m_clean = -s_adaptive.m_stable; }
+	}
+	s_adaptive.m_pending = false;
+	SDL_UnlockAudio();
+	s_adaptive.m_decisions++;
+	s_adaptive.m_last = decision;
+	if (!s_adaptive_callback.IsEmpty())
+	{
+		Nan::HandleScope scope;
+		Local<Value> argv[] = { _adaptive_decision_object(decision) };
+		Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(s_adaptive_callback), countof(argv), argv);
+	}
+}
+
+static void _adaptive_update(int len)
+{
+	int frame_size = _audio_frame_size();
+	if (!s_adaptive.m_enabled || s_adaptive.m_pending || (frame_size <= 0) || (s_audio_frequency <= 0)) { return; }
+	int frames = len / frame_size;
+	s_adaptive.m_elapsed += (double) frames / s_audio_frequency;
+	if (s_adaptive.m_elapsed < s_adaptive.m_window) { return; }
+	MixAdaptiveDecision decision;
+	SDL_zero(decision);
+	decision.m_from = frames;
+	decision.m_to = frames;
+	decision.m_late = s_audio_thread.m_late - s_adaptive.m_late_mark;
+	decision.m_callbacks = s_audio_thread.m_callbacks - s_adaptive.m_callback_mark;
+	_adaptive_reset();
+	double latency = frames * 1000.0 / s_audio_frequency;
+	if (decision.m_late == 0) { s_adaptive.m_limited = false; }
+	if ((int) decision.m_late >= s_adaptive.m_grow)
+	{
+		s_adaptive.m_clean = 0;
+		decision.m_to = SDL_min(frames * 2, s_adaptive.m_max);
+		decision.m_reason = (decision.m_to > frames)?(MIX_ADAPTIVE_UNDERRUN):(MIX_ADAPTIVE_LIMIT);
+		if ((decision.m_reason == MIX_ADAPTIVE_LIMIT) && s_adaptive.m_limited) { return; }
+		s_adaptive.m_limited = (decision.m_reason == MIX_ADAPTIVE_LIMIT);
+	}
+	else if (decision.m_late > 0)
+	{
+		s_adaptive.m_clean = 0;
+		return;
+	}
+	else if ((++s_adaptive.m_clean >= s_adaptive.m_stable) && ((frames / 2) >= s_adaptive.m_min) && ((s_adaptive.m_target <= 0) || (latency > s_adaptive.m_target)))
+	{
+		s_adaptive.m_clean = 0;
+		decision.m_to = frames / 2;
+		decision.m_reason = MIX_ADAPTIVE_TARGET;
+	}
+	else
+	{
+		return;
+	}
+	s_adaptive.m_pending = true;
+	s_adaptive.m_proposal = decision;
+	_audio_event_raise(MIX_EVENT_ADAPTIVE);
+}
+
+// chunk arena
+//
+// Loads given an arena move their decoded PCM into large slabs and hand the
+// decoder's buffer back right away, so long-lived chunk memory does not
+// fragment the heap.  Chunks in an arena have allocated = 0; Mix_FreeChunk
+// frees only the Mix_Chunk.  A chunk goes to the slab whose free tail fits
+// it most tightly, so the remainder of a slab that could not take one chunk
+// still takes smaller ones.  Clear halts and drops every member chunk, then
+// frees the slabs at once.
+
+static const size_t k_arena_align = 16;
+static const size_t k_arena_header = (sizeof(MixArena::Slab) + k_arena_align - 1) & ~(k_arena_align - 1);
+
+MixArena::MixArena(size_t slab_size) :
+	m_mutex(SDL_CreateMutex()),
+	m_refs(1),
+	m_generation(1),
+	m_slab_size(slab_size),
+	m_slabs(NULL),
+	m_wraps(NULL),
+	m_chunks(0),
+	m_live(0)
+{
+}
+
+MixArena::~MixArena()
+{
+	Clear();
+	SDL_DestroyMutex(m_mutex); m_mutex = NULL;
+}
+
+// called on a load worker thread; copies the chunk PCM into a slab
+bool MixArena::Place(Mix_Chunk* chunk, Uint32* generation)
+{
+	if (!chunk || !chunk->abuf || (chunk->alen == 0)) { return false; }
+	size_t size = (chunk->alen + k_arena_align - 1) & ~(k_arena_align - 1);
+	SDL_LockMutex(m_mutex);
+	Slab* slab = NULL;
+	for (Slab* tail = m_slabs; tail; tail = tail->m_next)
+	{
+		size_t room = tail->m_size - tail->m_used;
+		if ((room >= size) && (!slab || (room < (slab->m_size - slab->m_used)))) { slab = tail; }
+	}
+	if (!slab)
+	{
+		// large chunks get a slab of their own behind the current one
+		bool dedicated = m_slabs && (size > (m_slab_size / 2));
+		size_t slab_size = SDL_max(m_slab_size, size);
+		Slab* fresh = (Slab*) SDL_malloc(k_arena_header + slab_size);
+		if (!fresh) { SDL_UnlockMutex(m_mutex); return false; }
+		fresh->m_size = slab_size;
+		fresh->m_used = 0;
+		if (dedicated) { fresh->m_next = m_slabs->m_next; m_slabs->m_next = fresh; }
+		else { fresh->m_next = m_slabs; m_slabs = fresh; }
+		slab = fresh;
+	}
+	Uint8* abuf = (Uint8*) slab + k_arena_header + slab->m_used;
+	slab->m_used += size;
+	SDL_memcpy(abuf, chunk->abuf, chunk->alen);
+	*generation = m_generation;
+	SDL_UnlockMutex(m_mutex);
+	if (chunk->allocated) { SDL_free(chunk->abuf); }
+	chunk->abuf = abuf;
+	chunk->allocated = 0;
+	return true;
+}
+
+void MixArena::Adopt(WrapChunk* wrap)
+{
+	Mix_Chunk* chunk = wrap->Peek();
+	wrap->m_arena = this;
+	wrap->m_arena_size = (chunk)?(chunk->alen):(0);
+	wrap->m_arena_prev = NULL;
+	wrap->m_arena_next = m_wraps;
+	if (m_wraps) { m_wraps->m_arena_prev = wrap; }
+	m_wraps = wrap;
+	m_chunks++;
+	m_live += wrap->m_arena_size;
+	Retain();
+}
+
+void MixArena::Forget(WrapChunk* wrap)
+{
+	if (wrap->m_arena != this) { return; }
+	if (wrap->m_arena_prev) { wrap->m_arena_prev->m_arena_next = wrap->m_arena_next; }
+	else { m_wraps = wrap->m_arena_next; }
+	if (wrap->m_arena_next) { wrap->m_arena_next->m_arena_prev = wrap->m_arena_prev; }
+	m_chunks--;
+	m_live -= wrap->m_arena_size;
+	wrap->m_arena = NULL;
+	wrap->m_arena_size = 0;
+	wrap->m_arena_prev = NULL;
+	wrap->m_arena_next = NULL;
+	Release();
+}
+
+void MixArena::Clear()
+{
+	Retain(); // member wraps hold the other references
+	while (m_wraps)
+	{
+		WrapChunk* wrap = m_wraps;
+		WrapChunk::Free(wrap->Drop()); // neuters the buffer and halts channels playing it
+		Forget(wrap);
+	}
+	SDL_LockMutex(m_mutex);
+	while (m_slabs)
+	{
+		Slab* slab = m_slabs;
+		m_slabs = slab->m_next;
+		SDL_free(slab);
+	}
+	m_generation++;
+	SDL_UnlockMutex(m_mutex);
+	m_refs--; // not Release, which would delete from the destructor
+}
+
+size_t MixArena::Reserved()
+{
+	SDL_LockMutex(m_mutex);
+	size_t size = 0;
+	for (Slab* slab = m_slabs; slab; slab = slab->m_next) { size += slab->m_size; }
+	SDL_UnlockMutex(m_mutex);
+	return size;
+}
+
+size_t MixArena::Used()
+{
+	SDL_LockMutex(m_mutex);
+	size_t size = 0;
+	for (Slab* slab = m_slabs; slab; slab = slab->m_next) { size += slab->m_used; }
+	SDL_UnlockMutex(m_mutex);
+	return size;
+}
+
+// wrap MixArena pointer
+
+class WrapArena : public Nan::ObjectWrap
+{
+public:
+	MixArena* m_arena;
+public:
+	WrapArena(MixArena* arena) : m_arena(arena) {}
+	~WrapArena() { m_arena->Release(); m_arena = NULL; }
+public:
+	static WrapArena* Unwrap(Local<Value> value) { return (value->IsObject())?(Nan::ObjectWrap::Unwrap<WrapArena>(Local<Object>::Cast(value))):(NULL); }
+	static MixArena* Peek(Local<Value> value) { WrapArena* wrap = Unwrap(value); return (wrap)?(wrap->m_arena):(NULL); }
+public:
+	static Local<Object> NewInstance(MixArena* arena)
+	{
+		Nan::EscapableHandleScope scope;
+		static Nan::Persistent<ObjectTemplate> g_object_template;
+		if (g_object_template.IsEmpty())
+		{
+			Local<ObjectTemplate> object_template = Nan::New<ObjectTemplate>();
+			g_object_template.Reset(object_template);
+			object_template->SetInternalFieldCount(1);
+		}
+		Local<Object> instance = Nan::New<ObjectTemplate>(g_object_template)->NewInstance();
+		WrapArena* wrap = new WrapArena(arena);
+		wrap->Wrap(instance);
+		return scope.Escape(instance);
+	}
+};
+
+// load tracing
+
+// Load tasks stamp each phase with uv_hrtime(): the wait in the libuv queue,
+// file open and read, decoding (SDL_mixer decodes and converts to the device
+// format in one call) and this module's own passes over the PCM (trim,
+// normalize, analysis, arena placement).  Every load feeds the counters and
+// slowest list of Mix_GetLoadStats; loads given { stats: true } also pass
+// their timings to the callback.
+
+enum MixLoadKind
+{
+	MIX_LOAD_CHUNK,
+	MIX_LOAD_MUSIC,
+	MIX_LOAD_KIND_COUNT
+};
+
+struct MixLoadTrace
+{
+	uint64_t m_queued; // uv_hrtime(), ns
+	uint64_t m_started; // DoWork entered
+	uint64_t m_finished; // DoWork returned
+	double m_open; // ms
+	double m_read; // ms
+	double m_decode; // ms
+	double m_process; // ms, trim, normalize, analysis and arena placement
+	Sint64 m_bytes_in; // source bytes, -1 if unknown
+	Sint64 m_bytes_out; // decoded PCM bytes
+	const char* m_decoder;
+};
+
+struct MixLoadCounters
+{
+	int m_loads;
+	int m_failures;
+	double m_queue; // ms, summed
+	double m_queue_max;
+	double m_open;
+	double m_read;
+	double m_decode;
+	double m_process;
+	double m_total;
+	double m_total_max;
+	double m_bytes_in;
+	double m_bytes_out;
+};
+
+struct MixLoadSlow
+{
+	char m_file[256];
+	MixLoadKind m_kind;
+	const char* m_decoder;
+	double m_total; // ms
+};
+
+#define MIX_LOAD_SLOW_COUNT 8
+
+static MixLoadCounters s_load_counters[MIX_LOAD_KIND_COUNT];
+static MixLoadSlow s_load_slow[MIX_LOAD_SLOW_COUNT]; // slowest first
+static int s_load_slow_count = 0;
+
+static void _load_trace_init(MixLoadTrace* trace)
+{
+	SDL_zerop(trace);
+	trace->m_queued = uv_hrtime();
+	trace->m_bytes_in = -1;
+	trace->m_decoder = "unknown";
+}
+
+static double _load_ms(uint64_t from, uint64_t to)
+{
+	return (to > from)?((to - from) / 1e6):(0.0);
+}
+
+static const char* _load_chunk_decoder(const Uint8* magic, int size)
+{
+	if ((size >= 12) && (SDL_memcmp(magic, "RIFF", 4) == 0) && (SDL_memcmp(magic + 8, "WAVE", 4) == 0)) { return "WAVE"; }
+	if ((size >= 12) && (SDL_memcmp(magic, "FORM", 4) == 0)) { return "AIFF"; }
+	if ((size >= 4) && (SDL_memcmp(magic, "OggS", 4) == 0)) { return "OGG"; }
+	if ((size >= 4) && (SDL_memcmp(magic, "fLaC", 4) == 0)) { return "FLAC"; }
+	if ((size >= 19) && (SDL_memcmp(magic, "Creative Voice File", 19) == 0)) { return "VOC"; }
+	if ((size >= 3) && ((SDL_memcmp(magic, "ID3", 3) == 0) || ((magic[0] == 0xFF) && ((magic[1] & 0xE0) == 0xE0)))) { return "MP3"; }
+	return "unknown";
+}
+
+static const char* _load_music_decoder(Mix_MusicType type)
+{
+	switch (type)
+	{
+	case MUS_CMD: return "CMD";
+	case MUS_WAV: return "WAVE";
+	case MUS_MOD: return "MOD";
+	case MUS_MID: return "MIDI";
+	case MUS_OGG: return "OGG";
+	case MUS_MP3: return "MP3";
+	case MUS_MP3_MAD: return "MP3_MAD";
+	case MUS_FLAC: return "FLAC";
+	case MUS_MODPLUG: return "MODPLUG";
+	default: return "unknown";
+	}
+}
+
+// main thread, from DoAfterWork
+static void _load_trace_count(const MixLoadTrace& trace, MixLoadKind kind, const char* file, bool ok)
+{
+	double queue = _load_ms(trace.m_queued, trace.m_started);
+	double total = _load_ms(trace.m_queued, uv_hrtime());
+	MixLoadCounters& counters = s_load_counters[kind];
+	counters.m_loads++;
+	if (!ok) { counters.m_failures++; }
+	counters.m_queue += queue;
+	counters.m_queue_max = SDL_max(counters.m_queue_max, queue);
+	counters.m_open += trace.m_open;
+	counters.m_read += trace.m_read;
+	counters.m_decode += trace.m_decode;
+	counters.m_process += trace.m_process;
+	counters.m_total += total;
+	counters.m_total_max = SDL_max(counters.m_total_max, total);
+	if (trace.m_bytes_in > 0) { counters.m_bytes_in += (double) trace.m_bytes_in; }
+	counters.m_bytes_out += (double) trace.m_bytes_out;
+	int index = s_load_slow_count;
+	while ((index > 0) && (s_load_slow[index - 1].m_total < total)) { --index; }
+	if (index >= MIX_LOAD_SLOW_COUNT) { return; }
+	int last = SDL_min(s_load_slow_count, MIX_LOAD_SLOW_COUNT - 1);
+	SDL_memmove(&s_load_slow[index + 1], &s_load_slow[index], (last - index) * sizeof(MixLoadSlow));
+	MixLoadSlow& slow = s_load_slow[index];
+	SDL_strlcpy(slow.m_file, file, sizeof(slow.m_file));
+	slow.m_kind = kind;
+	slow.m_decoder = trace.m_decoder;
+	slow.m_total = total;
+	s_load_slow_count = last + 1;
+}
+
+static Local<Object> _load_trace_object(const MixLoadTrace& trace, const char* file)
+{
+	Nan::EscapableHandleScope scope;
+	uint64_t now = uv_hrtime();
+	Local<Object> result = Nan::New<Object>();
+	result->Set(NANX_SYMBOL("file"), NANX_STRING(file));
+	result->Set(NANX_SYMBOL("decoder"), NANX_STRING(trace.m_decoder));
+	result->Set(NANX_SYMBOL("queueMs"), Nan::New(_load_ms(trace.m_queued, trace.m_started)));
+	result->Set(NANX_SYMBOL("openMs"), Nan::New(trace.m_open));
+	result->Set(NANX_SYMBOL("readMs"), Nan::New(trace.m_read));
+	result->Set(NANX_SYMBOL("decodeMs"), Nan::New(trace.m_decode));
+	result->Set(NANX_SYMBOL("processMs"), Nan::New(trace.m_process));
+	result->Set(NANX_SYMBOL("workMs"), Nan::New(_load_ms(trace.m_started, trace.m_finished)));
+	result->Set(NANX_SYMBOL("callbackMs"), Nan::New(_load_ms(trace.m_finished, now))); // wait for the main thread
+	result->Set(NANX_SYMBOL("totalMs"), Nan::New(_load_ms(trace.m_queued, now)));
+	result->Set(NANX_SYMBOL("bytesIn"), Nan::New((double) trace.m_bytes_in));
+	result->Set(NANX_SYMBOL("bytesOut"), Nan::New((double) trace.m_bytes_out));
+	return scope.Escape(result);
+}
+
+static Local<Object> _load_counters_object(const MixLoadCounters& counters)
+{
+	Nan::EscapableHandleScope scope;
+	Local<Object> result = Nan::New<Object>();
+	result->Set(NANX_SYMBOL("loads"), Nan::New(counters.m_loads));
+	result->Set(NANX_SYMBOL("failures"), Nan::New(counters.m_failures));
+	result->Set(NANX_SYMBOL("queueMs"), Nan::New(counters.m_queue));
+	result->Set(NANX_SYMBOL("queueMaxMs"), Nan::New(counters.m_queue_max));
+	result->Set(NANX_SYMBOL("openMs"), Nan::New(counters.m_open));
+	result->Set(NANX_SYMBOL("readMs"), Nan::New(counters.m_read));
+	result->Set(NANX_SYMBOL("decodeMs"), Nan::New(counters.m_decode));
+	result->Set(NANX_SYMBOL("processMs"), Nan::New(counters.m_process));
+	result->Set(NANX_SYMBOL("totalMs"), Nan::New(counters.m_total));
+	result->Set(NANX_SYMBOL("totalMaxMs"), Nan::New(counters.m_total_max));
+	result->Set(NANX_SYMBOL("bytesIn"), Nan::New(counters.m_bytes_in));
+	result->Set(NANX_SYMBOL("bytesOut"), Nan::New(counters.m_bytes_out));
+	return scope.Escape(result);
+}
+
+// load chunk
+
+class Task_MIX_LoadWav : public Nanx::SimpleTask
+{
+public:
+	Nan::Persistent<Function> m_callback;
+	char* m_file;
+	void* m_data; // copy of an in-memory file
+	size_t m_size;
+	int m_frequency; // device spec at request time
+	::Uint16 m_format;
+	int m_channels;
+	bool m_trim;
+	double m_trim_threshold; // dBFS
+	double m_trim_fade; // ms
+	MixNormalize m_normalize;
+	double m_normalize_target; // dBFS peak or LUFS
+	double m_normalize_ceiling; // dBFS peak
+	bool m_analyze;
+	int m_envelope_size;
+	double m_silence; // dBFS
+	MixArena* m_arena;
+	bool m_placed; // PCM moved into an arena slab
+	Uint32 m_generation; // arena generation at placement
+	Mix_Chunk* m_chunk;
+	MixChunkAnalysis* m_analysis;
+	bool m_stats; // pass the load trace to the callback
+	MixLoadTrace m_trace;
+public:
+	Task_MIX_LoadWav(Local<Value> file, Local<Function> callback, Local<Value> options) : 
+		m_file(NULL), 
+		m_data(NULL), 
+		m_size(0), 
+		m_frequency(s_audio_frequency), 
+		m_format(s_audio_format), 
+		m_channels(s_audio_channels), 
+		m_trim(false), 
+		m_trim_threshold(-60.0), 
+		m_trim_fade(5.0), 
+		m_normalize(MIX_NORMALIZE_NONE), 
+		m_normalize_target(0.0), 
+		m_normalize_ceiling(0.0), 
+		m_analyze(false), 
+		m_envelope_size(0), 
+		m_silence(-60.0), 
+		m_arena(NULL), 
+		m_placed(false), 
+		m_generation(0), 
+		m_chunk(NULL), 
+		m_analysis(NULL), 
+		m_stats(_option_bool(options, "stats", false))
+	{
+		_load_trace_init(&m_trace);
+		m_callback.Reset(callback);
+		m_arena = WrapArena::Peek(_option(options, "arena"));
+		if (m_arena) { m_arena->Retain(); }
+		if (file->IsArrayBufferView())
+		{
+			Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(file);
+			m_size = view->ByteLength();
+			m_data = malloc(m_size);
+			view->CopyContents(m_data, m_size);
+		}
+		else
+		{
+			m_file = strdup(*String::Utf8Value(file));
+		}
+		Local<Value> trim = _option(options, "trim");
+		m_trim = trim->IsObject() || trim->BooleanValue();
+		m_trim_threshold = _option_double(trim, "threshold", m_trim_threshold);
+		m_trim_fade = SDL_max(0.0, _option_double(trim, "fade", m_trim_fade));
+		Local<Value> normalize = _option(options, "normalize");
+		if (_option(normalize, "loudness")->IsNumber())
+		{
+			m_normalize = MIX_NORMALIZE_LOUDNESS;
+			m_normalize_target = _option_double(normalize, "loudness", -16.0);
+			m_normalize_ceiling = _option_double(normalize, "ceiling", -1.0);
+		}
+		else if (normalize->IsObject() || normalize->BooleanValue())
+		{
+			m_normalize = MIX_NORMALIZE_PEAK;
+			m_normalize_target = _option_double(normalize, "peak", -1.0);
+			m_normalize_ceiling = _option_double(normalize, "ceiling", 0.0);
+		}
+		Local<Value> analysis = _option(options, "analysis");
+		m_analyze = analysis->IsObject() || analysis->BooleanValue();
+		m_envelope_size = SDL_max(0, _option_int(analysis, "envelope", 0));
+		m_silence = _option_double(analysis, "silence", m_silence);
+	}
+	~Task_MIX_LoadWav()
+	{
+		m_callback.Reset();
+		free(m_file); m_file = NULL; // strdup
+		free(m_data); m_data = NULL; // malloc
+		if (m_chunk) { Mix_FreeChunk(m_chunk); m_chunk = NULL; }
+		delete m_analysis; m_analysis = NULL;
+		if (m_arena) { m_arena->Release(); m_arena = NULL; }
+	}
+	void DoWork()
+	{
+		m_trace.m_started = uv_hrtime();
+		SDL_RWops* rw = (m_data)?(SDL_RWFromConstMem(m_data, (int) m_size)):(_open_file());
+		Uint8 magic[20] = { 0 };
+		size_t sniffed = (rw)?(SDL_RWread(rw, magic, 1, sizeof(magic))):(0);
+		if (sniffed) { SDL_RWseek(rw, -(Sint64) sniffed, RW_SEEK_CUR); }
+		m_trace.m_decoder = _load_chunk_decoder(magic, (int) sniffed);
+		if (m_data) { m_trace.m_bytes_in = (Sint64) m_size; }
+		uint64_t decode = uv_hrtime();
+		m_chunk = Mix_LoadWAV_RW(rw, 1);
+		uint64_t process = uv_hrtime();
+		m_trace.m_decode = _load_ms(decode, process);
+		if (m_chunk && m_trim)
+		{
+			_chunk_trim(m_chunk, m_frequency, m_format, m_channels, m_trim_threshold, m_trim_fade);
+		}
+		if (m_chunk && (m_normalize != MIX_NORMALIZE_NONE))
+		{
+			_chunk_normalize(m_chunk, m_frequency, m_format, m_channels, m_normalize, m_normalize_target, m_normalize_ceiling);
+		}
+		if (m_chunk && m_analyze)
+		{
+			m_analysis = _chunk_analyze(m_chunk->abuf, m_chunk->alen, m_frequency, m_format, m_channels, m_envelope_size, m_silence);
+		}
+		if (m_chunk && m_arena)
+		{
+			m_placed = m_arena->Place(m_chunk, &m_generation);
+		}
+		if (m_chunk) { m_trace.m_bytes_out = m_chunk->alen; }
+		m_trace.m_finished = uv_hrtime();
+		m_trace.m_process = _load_ms(process, m_trace.m_finished);
+	}
+	// With stats on, reads the whole file into m_data so I/O is timed apart
+	// from decoding, falling back to decoding from the file when its size is
+	// unknown; otherwise the decoder reads the file and readMs stays 0.
+	SDL_RWops* _open_file()
+	{
+		uint64_t start = uv_hrtime();
+		SDL_RWops* rw = SDL_RWFromFile(m_file, "rb");
+		uint64_t opened = uv_hrtime();
+		m_trace.m_open = _load_ms(start, opened);
+		if (!rw) { return NULL; }
+		Sint64 size = SDL_RWsize(rw);
+		m_trace.m_bytes_in = size;
+		if (!m_stats) { return rw; }
+		void* data = (size > 0)?(malloc((size_t) size)):(NULL);
+		if (data && (SDL_RWread(rw, data, 1, (size_t) size) == (size_t) size))
+		{
+			SDL_RWclose(rw);
+			m_data = data;
+			m_size = (size_t) size;
+			rw = SDL_RWFromConstMem(m_data, (int) m_size);
+		}
+		else
+		{
+			free(data); // not a regular file, or a short read
+			SDL_RWseek(rw, 0, RW_SEEK_SET);
+		}
+		m_trace.m_read = _load_ms(opened, uv_hrtime());
+		return rw;
+	}
+	void DoAfterWork(int status)
+	{
+		Nan::HandleScope scope;
+		if (m_placed && (m_arena->m_generation != m_generation))
+		{
+			// the arena was released while loading; its slab is gone
+			Mix_SetError("Mix_LoadWAV: arena released during load");
+			Mix_FreeChunk(m_chunk); m_chunk = NULL;
+			delete m_analysis; m_analysis = NULL;
+		}
+		Local<Value> chunk = WrapChunk::Hold(m_chunk, m_analysis);
+		m_analysis = NULL; // wrap owns analysis
+		if (m_chunk && m_placed) { m_arena->Adopt(WrapChunk::Unwrap(chunk)); }
+		const char* file = (m_file)?(m_file):("<buffer>");
+		_load_trace_count(m_trace, MIX_LOAD_CHUNK, file, m_chunk != NULL);
+		Local<Value> argv[] = { chunk, (m_stats)?(Local<Value>(_load_trace_object(m_trace, file))):(Local<Value>(Nan::Undefined())) };
+		Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(m_callback), (m_stats)?(2):(1), argv);
+		m_chunk = NULL; // script owns pointer
+	}
+};
+
+// music prefetch
 
-static Nan::Persistent<Function> s_music_finished_callback;
+// Serves a music file to the SDL_mixer decoder from a block cache that a
+// reader thread fills ahead of the decoder.  The cache keeps the head of the
+// file, where loops restart, a read-ahead window past the decoder position
+// and the window Mix_PrerollMusic pins around a seek target; other blocks are
+// freed, so a large file never sits in memory whole.  While the load task
+// opens the decoder, reads wait for their blocks.  After that the decoder,
+// which runs on the audio thread, never waits: a read past the resident bytes
+// returns short and counts a stall.  Preroll times convert to bytes at the
+// bitrate option, the WAVE header byte rate, or an upper bound for the
+// format.  SDL_mixer owns the SDL_RWops and closes it on Mix_FreeMusic.
 
-static void _music_finished_set_callback(Local<Function> callback)
+class MixMusicPrefetch
 {
-	s_music_finished_callback.Reset();
-	if (!callback->IsNull())
+public:
+	static const Sint64 k_block_size = 64 * 1024;
+public:
+	SDL_atomic_t m_refs; // SDL_RWops and pending preroll tasks
+	SDL_mutex* m_mutex;
+	SDL_cond* m_cond;
+	SDL_Thread* m_thread;
+	SDL_RWops* m_file; // reader thread only
+	Sint64 m_size;
+	int m_count;
+	Uint8** m_blocks; // NULL until read
+	Sint64 m_resident; // bytes in memory
+	Sint64 m_offset; // decoder position
+	Sint64 m_head; // bytes kept from the start of the file
+	Sint64 m_window; // bytes read ahead of the decoder
+	Sint64 m_pin; // pinned seek window, empty when m_pin_end <= m_pin
+	Sint64 m_pin_end;
+	double m_byte_rate; // bytes per second
+	bool m_loading; // decoder reads wait for their blocks
+	bool m_quit;
+	int m_stalls; // short reads after loading
+	Mix_Music* m_music; // main thread only
+	MixMusicPrefetch* m_next; // s_prefetch_list
+	bool m_linked;
+public:
+	MixMusicPrefetch(SDL_RWops* file, Sint64 size, double byte_rate) :
+		m_mutex(SDL_CreateMutex()),
+		m_cond(SDL_CreateCond()),
+		m_thread(NULL),
+		m_file(file),
+		m_size(size),
+		m_count((int) ((size + k_block_size - 1) / k_block_size)),
+		m_blocks(NULL),
+		m_resident(0),
+		m_offset(0),
+		m_head(k_block_size),
+		m_window(k_block_size),
+		m_pin(0),
+		m_pin_end(0),
+		m_byte_rate(byte_rate),
+		m_loading(true),
+		m_quit(false),
+		m_stalls(0),
+		m_music(NULL),
+		m_next(NULL),
+		m_linked(false)
 	{
-		s_music_finished_callback.Reset(callback);
+		SDL_AtomicSet(&m_refs, 1);
+		m_blocks = (Uint8**) SDL_calloc(m_count, sizeof(Uint8*));
+	}
+	~MixMusicPrefetch()
+	{
+		if (m_thread)
+		{
+			SDL_LockMutex(m_mutex);
+			m_quit = true;
+			SDL_CondBroadcast(m_cond);
+			SDL_UnlockMutex(m_mutex);
+			SDL_WaitThread(m_thread, NULL); m_thread = NULL;
+		}
+		if (m_file) { SDL_RWclose(m_file); m_file = NULL; }
+		for (int i = 0; m_blocks && (i < m_count); ++i) { SDL_free(m_blocks[i]); }
+		SDL_free(m_blocks); m_blocks = NULL;
+		SDL_DestroyCond(m_cond); m_cond = NULL;
+		SDL_DestroyMutex(m_mutex); m_mutex = NULL;
 	}
-}
-
-class TaskMusicFinished : public Nanx::SimpleTask
-{
 public:
-	void DoWork() {}
-	void DoAfterWork(int status)
+	void Retain() { SDL_AtomicAdd(&m_refs, 1); }
+	void Release() { if (SDL_AtomicAdd(&m_refs, -1) == 1) { delete this; } }
+public:
+	// called on the load worker thread; options { preroll, ahead: ms, bitrate: bits/s, complete }
+	static SDL_RWops* Open(const char* file, double preroll, double ahead, double bitrate, bool complete)
 	{
-		if (!s_music_finished_callback.IsEmpty())
+		SDL_RWops* rw = SDL_RWFromFile(file, "rb");
+		if (!rw) { return NULL; }
+		Sint64 size = SDL_RWsize(rw);
+		if (size <= 0) { return rw; } // not a regular file, decode from it directly
+		Uint8 header[32] = { 0 };
+		size_t sniffed = SDL_RWread(rw, header, 1, sizeof(header));
+		SDL_RWseek(rw, 0, RW_SEEK_SET);
+		double byte_rate = (bitrate > 0)?(bitrate / 8):(_byte_rate(header, (int) sniffed));
+		MixMusicPrefetch* prefetch = new MixMusicPrefetch(rw, size, byte_rate);
+		if (!prefetch->m_blocks) { prefetch->m_file = NULL; delete prefetch; return rw; }
+		Sint64 preroll_bytes = prefetch->Bytes(preroll);
+		prefetch->m_head = (complete)?(size):(SDL_max(preroll_bytes, k_block_size));
+		prefetch->m_window = (complete)?(size):(SDL_max(prefetch->Bytes(ahead), preroll_bytes + k_block_size));
+		prefetch->m_thread = SDL_CreateThread(_reader, "Mix_MusicPrefetch", prefetch);
+		if (!prefetch->m_thread) { prefetch->m_file = NULL; delete prefetch; return rw; }
+		SDL_RWops* ops = SDL_AllocRW();
+		ops->size = _size;
+		ops->seek = _seek;
+		ops->read = _read;
+		ops->write = _write;
+		ops->close = _close;
+		ops->type = SDL_RWOPS_UNKNOWN;
+		ops->hidden.unknown.data1 = prefetch;
+		ops->hidden.unknown.data2 = NULL;
+		return ops;
+	}
+	static MixMusicPrefetch* Peek(SDL_RWops* ops)
+	{
+		return (ops && (ops->close == _close))?((MixMusicPrefetch*) ops->hidden.unknown.data1):(NULL);
+	}
+public:
+	Sint64 Bytes(double ms)
+	{
+		return (Sint64) (SDL_max(ms, 0.0) * m_byte_rate / 1000);
+	}
+	// block until the bytes from..to are resident; false if the file ended or
+	// the prefetch closed first
+	bool Wait(Sint64 from, Sint64 to)
+	{
+		SDL_LockMutex(m_mutex);
+		while (!m_quit && !_resident(from, to)) { SDL_CondWait(m_cond, m_mutex); }
+		bool ok = !m_quit && (from < m_size);
+		SDL_UnlockMutex(m_mutex);
+		return ok;
+	}
+	// block until ms past the decoder position, or the whole file, are
+	// resident, then stop waiting in decoder reads; called on the load worker
+	void Preroll(double ms, bool complete)
+	{
+		SDL_LockMutex(m_mutex);
+		Sint64 from = (complete)?(0):(m_offset);
+		Sint64 to = (complete)?(m_size):(from + SDL_max(Bytes(ms), (Sint64) 1));
+		SDL_UnlockMutex(m_mutex);
+		Wait(from, to);
+		SDL_LockMutex(m_mutex);
+		m_loading = false;
+		SDL_UnlockMutex(m_mutex);
+	}
+	// keep ms after the byte estimate of a position, and a block before it, in
+	// memory; returns the range to wait for
+	void Pin(double position, double ms, Sint64* from, Sint64* to)
+	{
+		SDL_LockMutex(m_mutex);
+		Sint64 target = SDL_min((Sint64) (SDL_max(position, 0.0) * m_byte_rate), m_size);
+		m_pin = SDL_max(target - k_block_size, (Sint64) 0);
+		m_pin_end = SDL_min(target + SDL_max(Bytes(ms), (Sint64) 1), m_size);
+		*from = m_pin; *to = m_pin_end;
+		SDL_CondBroadcast(m_cond);
+		SDL_UnlockMutex(m_mutex);
+	}
+	void Stats(Local<Object> result)
+	{
+		SDL_LockMutex(m_mutex);
+		result->Set(NANX_SYMBOL("size"), Nan::New((double) m_size));
+		result->Set(NANX_SYMBOL("resident"), Nan::New((double) m_resident));
+		result->Set(NANX_SYMBOL("position"), Nan::New((double) m_offset));
+		result->Set(NANX_SYMBOL("byteRate"), Nan::New(m_byte_rate));
+		result->Set(NANX_SYMBOL("stalls"), Nan::New(m_stalls));
+		SDL_UnlockMutex(m_mutex);
+	}
+private:
+	// WAVE byte rate from a canonical header, else an upper bound: CD audio
+	// for FLAC and unknown formats, 320 kbit/s for the compressed ones
+	static double _byte_rate(const Uint8* header, int size)
+	{
+		if ((size >= 32) && (SDL_memcmp(header, "RIFF", 4) == 0) && (SDL_memcmp(header + 8, "WAVEfmt ", 8) == 0))
 		{
-			Nan::HandleScope scope;
-			Mix_HookMusicFinished(NULL);
-			Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(s_music_finished_callback), 0, NULL);
-			Mix_HookMusicFinished(_music_finished_callback);
+			Uint32 rate = header[28] | (header[29] << 8) | (header[30] << 16) | ((Uint32) header[31] << 24);
+			if (rate > 0) { return rate; }
+		}
+		if ((size >= 4) && ((SDL_memcmp(header, "OggS", 4) == 0) || (SDL_memcmp(header, "ID3", 3) == 0) || ((header[0] == 0xFF) && ((header[1] & 0xE0) == 0xE0))))
+		{
+			return 320000 / 8;
+		}
+		return 44100 * 4;
+	}
+	bool _resident(Sint64 from, Sint64 to)
+	{
+		to = SDL_min(to, m_size);
+		for (Sint64 block = from / k_block_size; (block * k_block_size) < to; ++block)
+		{
+			if (!m_blocks[block]) { return false; }
+		}
+		return true;
+	}
+	bool _keep(int block)
+	{
+		Sint64 start = block * k_block_size;
+		Sint64 end = start + k_block_size;
+		if (start < m_head) { return true; }
+		if ((end > m_offset - k_block_size) && (start < m_offset + m_window)) { return true; }
+		return (end > m_pin) && (start < m_pin_end);
+	}
+	// next block to read: the decoder window first, then the pin, then the head
+	int _want()
+	{
+		Sint64 ranges[3][2] = { { m_offset, m_offset + m_window }, { m_pin, m_pin_end }, { 0, m_head } };
+		for (int i = 0; i < 3; ++i)
+		{
+			Sint64 to = SDL_min(ranges[i][1], m_size);
+			for (Sint64 block = ranges[i][0] / k_block_size; (block * k_block_size) < to; ++block)
+			{
+				if (!m_blocks[block]) { return (int) block; }
+			}
+		}
+		return -1;
+	}
+	// unlink one block the decoder has left behind
+	Uint8* _evict()
+	{
+		for (int block = 0; block < m_count; ++block)
+		{
+			if (m_blocks[block] && !_keep(block))
+			{
+				Uint8* data = m_blocks[block];
+				m_blocks[block] = NULL;
+				m_resident -= SDL_min(k_block_size, m_size - block * k_block_size);
+				return data;
+			}
+		}
+		return NULL;
+	}
+	static int _reader(void* data)
+	{
+		MixMusicPrefetch* prefetch = (MixMusicPrefetch*) data;
+		SDL_LockMutex(prefetch->m_mutex);
+		while (!prefetch->m_quit)
+		{
+			Uint8* evicted = prefetch->_evict();
+			int block = (evicted)?(-1):(prefetch->_want());
+			if (!evicted && (block < 0)) { SDL_CondWait(prefetch->m_cond, prefetch->m_mutex); continue; }
+			Sint64 start = (Sint64) block * k_block_size;
+			size_t want = (block < 0)?(0):((size_t) SDL_min(k_block_size, prefetch->m_size - start));
+			SDL_UnlockMutex(prefetch->m_mutex);
+			SDL_free(evicted);
+			Uint8* read = (want > 0)?((Uint8*) SDL_malloc(want)):(NULL);
+			size_t got = 0;
+			if (read && (SDL_RWseek(prefetch->m_file, start, RW_SEEK_SET) == start))
+			{
+				got = SDL_RWread(prefetch->m_file, read, 1, want);
+			}
+			SDL_LockMutex(prefetch->m_mutex);
+			if (want == 0) { continue; }
+			if (got == want)
+			{
+				prefetch->m_blocks[block] = read;
+				prefetch->m_resident += (Sint64) want;
+			}
+			else
+			{
+				// read error or a file that shrank: it ends at this block
+				SDL_free(read);
+				prefetch->m_size = start;
+				for (int i = block; i < prefetch->m_count; ++i) { SDL_free(prefetch->m_blocks[i]); prefetch->m_blocks[i] = NULL; }
+				prefetch->m_count = block;
+			}
+			SDL_CondBroadcast(prefetch->m_cond);
+		}
+		SDL_UnlockMutex(prefetch->m_mutex);
+		return 0;
+	}
+	static Sint64 _size(SDL_RWops* ops)
+	{
+		MixMusicPrefetch* prefetch = (MixMusicPrefetch*) ops->hidden.unknown.data1;
+		return prefetch->m_size;
+	}
+	static Sint64 _seek(SDL_RWops* ops, Sint64 offset, int whence)
+	{
+		MixMusicPrefetch* prefetch = (MixMusicPrefetch*) ops->hidden.unknown.data1;
+		SDL_LockMutex(prefetch->m_mutex);
+		switch (whence)
+		{
+		case RW_SEEK_SET: break;
+		case RW_SEEK_CUR: offset += prefetch->m_offset; break;
+		case RW_SEEK_END: offset += prefetch->m_size; break;
+		default: SDL_UnlockMutex(prefetch->m_mutex); return SDL_SetError("Unknown value for 'whence'");
+		}
+		if (offset < 0) { SDL_UnlockMutex(prefetch->m_mutex); return SDL_SetError("Seek before start of prefetch stream"); }
+		prefetch->m_offset = SDL_min(offset, prefetch->m_size);
+		SDL_CondBroadcast(prefetch->m_cond); // the read-ahead window moved
+		SDL_UnlockMutex(prefetch->m_mutex);
+		return offset;
+	}
+	static size_t _read(SDL_RWops* ops, void* ptr, size_t size, size_t maxnum)
+	{
+		MixMusicPrefetch* prefetch = (MixMusicPrefetch*) ops->hidden.unknown.data1;
+		if ((size == 0) || (maxnum == 0)) { return 0; }
+		SDL_LockMutex(prefetch->m_mutex);
+		Sint64 end = prefetch->m_offset + (Sint64) SDL_min((Sint64) maxnum, (prefetch->m_size - prefetch->m_offset) / (Sint64) size) * (Sint64) size;
+		Sint64 offset = prefetch->m_offset;
+		while (offset < end)
+		{
+			int block = (int) (offset / k_block_size);
+			if (!prefetch->m_blocks[block])
+			{
+				if (!prefetch->m_loading) { ++prefetch->m_stalls; break; } // short read
+				if (prefetch->m_quit) { break; }
+				SDL_CondBroadcast(prefetch->m_cond);
+				SDL_CondWait(prefetch->m_cond, prefetch->m_mutex);
+				end = SDL_min(end, prefetch->m_size); // the file may have ended
+				continue;
+			}
+			Sint64 count = SDL_min(end, (block + 1) * k_block_size) - offset;
+			SDL_memcpy((Uint8*) ptr + (offset - prefetch->m_offset), prefetch->m_blocks[block] + (offset - block * k_block_size), (size_t) count);
+			offset += count;
 		}
+		size_t num = (size_t) ((offset - prefetch->m_offset) / (Sint64) size);
+		prefetch->m_offset += (Sint64) (num * size);
+		SDL_CondBroadcast(prefetch->m_cond); // the read-ahead window moved
+		SDL_UnlockMutex(prefetch->m_mutex);
+		return num;
+	}
+	static size_t _write(SDL_RWops* ops, const void* ptr, size_t size, size_t num)
+	{
+		SDL_SetError("Prefetch stream is read-only");
+		return 0;
+	}
+	static int _close(SDL_RWops* ops)
+	{
+		MixMusicPrefetch* prefetch = (MixMusicPrefetch*) ops->hidden.unknown.data1;
+		Unlink(prefetch);
+		SDL_LockMutex(prefetch->m_mutex);
+		prefetch->m_quit = true; // wakes pending preroll tasks
+		SDL_CondBroadcast(prefetch->m_cond);
+		SDL_UnlockMutex(prefetch->m_mutex);
+		prefetch->Release();
+		SDL_FreeRW(ops);
+		return 0;
 	}
+public:
+	// music to prefetch lookup, main thread only
+	static void Link(MixMusicPrefetch* prefetch, Mix_Music* music);
+	static void Unlink(MixMusicPrefetch* prefetch);
+	static MixMusicPrefetch* Find(Mix_Music* music);
 };
 
-static void _music_finished_callback(void)
+static MixMusicPrefetch* s_prefetch_list = NULL;
+
+void MixMusicPrefetch::Link(MixMusicPrefetch* prefetch, Mix_Music* music)
 {
-	int err = Nanx::SimpleTask::Run(new TaskMusicFinished());
+	prefetch->m_music = music;
+	prefetch->m_next = s_prefetch_list;
+	prefetch->m_linked = true;
+	s_prefetch_list = prefetch;
 }
 
-static void _music_finished_init(void)
+// a prefetch that closes on the load worker, when the decoder fails to open,
+// was never linked
+void MixMusicPrefetch::Unlink(MixMusicPrefetch* prefetch)
 {
-	Mix_HookMusicFinished(_music_finished_callback);
+	if (!prefetch->m_linked) { return; }
+	for (MixMusicPrefetch** link = &s_prefetch_list; *link; link = &(*link)->m_next)
+	{
+		if (*link == prefetch) { *link = prefetch->m_next; break; }
+	}
+	prefetch->m_linked = false;
 }
 
-static void _music_finished_quit(void)
+MixMusicPrefetch* MixMusicPrefetch::Find(Mix_Music* music)
 {
-	Mix_HookMusicFinished(NULL);
-	s_music_finished_callback.Reset();
+	for (MixMusicPrefetch* prefetch = s_prefetch_list; prefetch; prefetch = prefetch->m_next)
+	{
+		if (music && (prefetch->m_music == music)) { return prefetch; }
+	}
+	return NULL;
 }
 
-// channel finished callback
-
-static void _channel_finished_set_callback(Local<Function> callback);
-static void _channel_finished_callback(int channel);
-
-static Nan::Persistent<Function> s_channel_finished_callback;
-
-static void _channel_finished_set_callback(Local<Function> callback)
+// wait on a load worker for a seek window to become resident
+class Task_MIX_PrerollMusic : public Nanx::SimpleTask
 {
-	s_channel_finished_callback.Reset();
-	if (!callback->IsNull())
+public:
+	Nan::Persistent<Function> m_callback;
+	MixMusicPrefetch* m_prefetch;
+	Sint64 m_from;
+	Sint64 m_to;
+	bool m_ok;
+public:
+	// a NULL prefetch calls back false, still from the task queue
+	Task_MIX_PrerollMusic(MixMusicPrefetch* prefetch, Sint64 from, Sint64 to, Local<Function> callback) :
+		m_prefetch(prefetch),
+		m_from(from),
+		m_to(to),
+		m_ok(false)
 	{
-		s_channel_finished_callback.Reset(callback);
+		m_callback.Reset(callback);
+		if (m_prefetch) { m_prefetch->Retain(); }
 	}
-}
+	~Task_MIX_PrerollMusic()
+	{
+		m_callback.Reset();
+		if (m_prefetch) { m_prefetch->Release(); m_prefetch = NULL; }
+	}
+	void DoWork()
+	{
+		m_ok = m_prefetch && m_prefetch->Wait(m_from, m_to);
+	}
+	void DoAfterWork(int status)
+	{
+		if (m_callback.IsEmpty()) { return; }
+		Nan::HandleScope scope;
+		Local<Value> argv[] = { Nan::New(m_ok) };
+		Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(m_callback), countof(argv), argv);
+	}
+};
 
-static void _channel_finished_init(void)
+// music stream
+//
+// Serves compressed music that script writes as it arrives, e.g. from a
+// socket.  Bytes go into a fixed ring and are discarded once the decoder has
+// read them, so the stream cannot seek and the type is sniffed up front; WAV
+// needs seeking and is refused.  The load is queued only once the prebuffer
+// is written, so no worker thread waits on script.  SDL_mixer decodes music
+// on the audio thread, which must never wait for script: when the ring drops
+// under the guard the audio thread marks the stream and the main thread
+// pauses the music, and Mix_WriteMusicStream resumes it once enough input is
+// buffered again.
+
+enum MixMusicStreamEvent { MIX_STREAM_NEED, MIX_STREAM_STARVE, MIX_STREAM_RESUME };
+
+class MixMusicStream;
+class WrapMusicStream;
+
+static MixMusicStream* s_music_starved = NULL; // paused by a stream, under the audio device lock
+static MixMusicStream* s_music_streams = NULL; // live streams, main thread only
+
+class TaskMusicStreamEvent : public Nanx::SimpleTask
 {
-	Mix_ChannelFinished(_channel_finished_callback);
-}
+public:
+	MixMusicStream* m_stream;
+	int m_event;
+public:
+	TaskMusicStreamEvent(MixMusicStream* stream, int event);
+	~TaskMusicStreamEvent();
+	void DoWork() {}
+	void DoAfterWork(int status);
+};
 
-static void _channel_finished_quit(void)
+class MixMusicStream
 {
-	Mix_ChannelFinished(NULL);
-	s_channel_finished_callback.Reset();
-}
+public:
+	SDL_atomic_t m_refs; // script wrap, SDL_RWops and pending tasks
+	SDL_mutex* m_mutex;
+	Uint8* m_data;
+	int m_capacity;
+	int m_head; // next byte for the decoder
+	int m_buffered;
+	int m_prebuffer; // bytes before the decoder is opened
+	int m_guard; // pause the music under this many bytes
+	int m_resume; // bytes needed to resume after starving
+	int m_low; // ask for input under this many bytes
+	double m_byte_rate; // bytes per second hint, 0 to measure
+	Sint64 m_written;
+	Sint64 m_consumed;
+	Sint64 m_open_consumed; // bytes the decoder read while opening
+	double m_played; // music seconds at the last decoder read
+	int m_starvations;
+	int m_underruns; // reads that found the ring empty
+	bool m_ended;
+	bool m_opened;
+	bool m_need_armed;
+	bool m_need_pending; // marked by the audio thread for the main thread
+	bool m_starved;
+	bool m_starve_pending;
+	Mix_MusicType m_type;
+	Mix_Music* m_music; // the decoder reading this stream, NULL once freed
+	Nanx::SimpleTask* m_load; // waiting for the prebuffer; main thread only
+	bool m_loading; // main thread only
+	WrapMusicStream* m_wrap; // main thread only
+	MixMusicStream* m_next; // s_music_streams
+public:
+	MixMusicStream(Local<Value> options) :
+		m_mutex(SDL_CreateMutex()),
+		m_data(NULL),
+		m_capacity(SDL_max(_option_int(options, "capacity", 256 * 1024), 4096)),
+		m_head(0),
+		m_buffered(0),
+		m_prebuffer(0),
+		m_guard(0),
+		m_resume(0),
+		m_low(0),
+		m_byte_rate(SDL_max(_option_double(options, "bitrate", 0.0), 0.0) / 8),
+		m_written(0),
+		m_consumed(0),
+		m_open_consumed(0),
+		m_played(0),
+		m_starvations(0),
+		m_underruns(0),
+		m_ended(false),
+		m_opened(false),
+		m_need_armed(true),
+		m_need_pending(false),
+		m_starved(false),
+		m_starve_pending(false),
+		m_type((Mix_MusicType) _option_int(options, "type", MUS_NONE)),
+		m_music(NULL),
+		m_load(NULL),
+		m_loading(false),
+		m_wrap(NULL),
+		m_next(s_music_streams)
+	{
+		s_music_streams = this;
+		SDL_AtomicSet(&m_refs, 1);
+		m_data = (Uint8*) SDL_malloc(m_capacity);
+		m_guard = SDL_max(0, SDL_min(_option_int(options, "guard", 32 * 1024), m_capacity / 2));
+		m_prebuffer = SDL_max(m_guard, SDL_min(_option_int(options, "prebuffer", m_capacity / 4), m_capacity));
+		m_resume = SDL_max(m_guard, SDL_min(_option_int(options, "resume", m_prebuffer), m_capacity));
+		m_low = SDL_max(m_guard, SDL_min(_option_int(options, "low", m_capacity / 2), m_capacity));
+	}
+	~MixMusicStream()
+	{
+		SDL_LockAudio();
+		if (s_music_starved == this) { s_music_starved = NULL; }
+		SDL_UnlockAudio();
+		MixMusicStream** link = &s_music_streams;
+		while (*link && (*link != this)) { link = &(*link)->m_next; }
+		if (*link) { *link = m_next; }
+		SDL_free(m_data); m_data = NULL;
+		SDL_DestroyMutex(m_mutex); m_mutex = NULL;
+	}
+public:
+	void Retain() { SDL_AtomicAdd(&m_refs, 1); }
+	void Release() { if (SDL_AtomicAdd(&m_refs, -1) == 1) { delete this; } }
+public:
+	// copy what fits in the ring; returns the bytes accepted
+	int Write(const Uint8* data, int size)
+	{
+		SDL_LockMutex(m_mutex);
+		int count = (m_ended || !m_data)?(0):(SDL_min(size, m_capacity - m_buffered));
+		int tail = (m_head + m_buffered) % m_capacity;
+		int first = SDL_min(count, m_capacity - tail);
+		SDL_memcpy(m_data + tail, data, first);
+		SDL_memcpy(m_data, data + first, count - first);
+		m_buffered += count;
+		m_written += count;
+		if (m_buffered >= m_low) { m_need_armed = true; }
+		bool resume = m_starved && (m_buffered >= m_resume);
+		if (resume) { m_starved = false; }
+		bool load = m_load && (m_buffered >= m_prebuffer);
+		SDL_UnlockMutex(m_mutex);
+		if (resume) { _resume(); }
+		if (load) { _load_run(); }
+		return count;
+	}
+	void End()
+	{
+		SDL_LockMutex(m_mutex);
+		m_ended = true;
+		bool resume = m_starved;
+		m_starved = false;
+		SDL_UnlockMutex(m_mutex);
+		if (resume) { _resume(); }
+		if (m_load) { _load_run(); }
+	}
+	// main thread; the load runs now if the prebuffer is written, or from
+	// Write or End once it is.  false if the stream already has a decoder.
+	bool Load(Nanx::SimpleTask* load)
+	{
+		if (m_loading) { return false; }
+		m_loading = true;
+		m_load = load;
+		SDL_LockMutex(m_mutex);
+		bool ready = m_ended || (m_buffered >= m_prebuffer);
+		SDL_UnlockMutex(m_mutex);
+		if (ready) { _load_run(); }
+		return true;
+	}
+	// called on the load worker thread once the prebuffer is written
+	Mix_Music* Open(MixLoadTrace* trace)
+	{
+		SDL_LockMutex(m_mutex);
+		trace->m_bytes_in = m_buffered;
+		Uint8 magic[4] = { 0 };
+		for (int i = 0; i < SDL_min(m_buffered, 4); ++i) { magic[i] = m_data[(m_head + i) % m_capacity]; }
+		Mix_MusicType type = (m_type != MUS_NONE)?(m_type):(_sniff(magic, SDL_min(m_buffered, 4)));
+		SDL_UnlockMutex(m_mutex);
+		if (type == MUS_NONE) { Mix_SetError("Unrecognized music stream format"); return NULL; }
+		if (type == MUS_WAV) { Mix_SetError("WAV music needs a seekable source; use Mix_LoadMUS"); return NULL; }
+		Retain(); // released by _close
+		SDL_RWops* ops = SDL_AllocRW();
+		ops->size = _size;
+		ops->seek = _seek;
+		ops->read = _read;
+		ops->write = _write;
+		ops->close = _close;
+		ops->type = SDL_RWOPS_UNKNOWN;
+		ops->hidden.unknown.data1 = this;
+		ops->hidden.unknown.data2 = NULL;
+		uint64_t decode = uv_hrtime();
+		Mix_Music* music = Mix_LoadMUSType_RW(ops, type, 1); // closes ops on failure and on Mix_FreeMusic
+		trace->m_decode = _load_ms(decode, uv_hrtime());
+		trace->m_decoder = _load_music_decoder(type);
+		SDL_LockMutex(m_mutex);
+		m_opened = (music != NULL);
+		m_open_consumed = m_consumed;
+		m_music = music;
+		SDL_UnlockMutex(m_mutex);
+		return music;
+	}
+	// main thread, from the audio events: pause the music for a stream that
+	// starved and still is, and send the events the audio thread marked
+	void Pending()
+	{
+		SDL_LockAudio();
+		SDL_LockMutex(m_mutex);
+		bool starve = m_starve_pending && m_starved;
+		bool need = m_need_pending;
+		m_starve_pending = false;
+		m_need_pending = false;
+		if (starve && m_music && (m_music == s_music_current) && (Mix_PlayingMusic() != 0) && (Mix_PausedMusic() == 0))
+		{
+			s_music_starved = this;
+			Mix_PauseMusic();
+		}
+		SDL_UnlockMutex(m_mutex);
+		SDL_UnlockAudio();
+		if (starve) { Nanx::SimpleTask::Run(new TaskMusicStreamEvent(this, MIX_STREAM_STARVE)); }
+		if (need) { Nanx::SimpleTask::Run(new TaskMusicStreamEvent(this, MIX_STREAM_NEED)); }
+	}
+	void Stats(Local<Object> result)
+	{
+		SDL_LockMutex(m_mutex);
+		double byte_rate = m_byte_rate;
+		if ((byte_rate <= 0) && (m_played >= 1.0)) { byte_rate = (m_consumed - m_open_consumed) / m_played; }
+		result->Set(NANX_SYMBOL("capacity"), Nan::New(m_capacity));
+		result->Set(NANX_SYMBOL("buffered"), Nan::New(m_buffered));
+		result->Set(NANX_SYMBOL("bufferedMs"), Nan::New((byte_rate > 0)?(m_buffered * 1000.0 / byte_rate):(-1.0)));
+		result->Set(NANX_SYMBOL("written"), Nan::New((double) m_written));
+		result->Set(NANX_SYMBOL("consumed"), Nan::New((double) m_consumed));
+		result->Set(NANX_SYMBOL("starvations"), Nan::New(m_starvations));
+		result->Set(NANX_SYMBOL("underruns"), Nan::New(m_underruns));
+		result->Set(NANX_SYMBOL("starved"), Nan::New(m_starved));
+		result->Set(NANX_SYMBOL("ended"), Nan::New(m_ended));
+		SDL_UnlockMutex(m_mutex);
+	}
+private:
+	void _resume()
+	{
+		SDL_LockAudio();
+		bool resume = (s_music_starved == this);
+		if (resume) { s_music_starved = NULL; Mix_ResumeMusic(); }
+		SDL_UnlockAudio();
+		if (resume) { Nanx::SimpleTask::Run(new TaskMusicStreamEvent(this, MIX_STREAM_RESUME)); }
+	}
+	void _load_run()
+	{
+		Nanx::SimpleTask* load = m_load;
+		m_load = NULL;
+		Nanx::SimpleTask::Run(load);
+	}
+	static Mix_MusicType _sniff(const Uint8* magic, int size)
+	{
+		if (size < 4) { return MUS_NONE; }
+		if (SDL_memcmp(magic, "OggS", 4) == 0) { return MUS_OGG; }
+		if (SDL_memcmp(magic, "fLaC", 4) == 0) { return MUS_FLAC; }
+		if ((SDL_memcmp(magic, "RIFF", 4) == 0) || (SDL_memcmp(magic, "FORM", 4) == 0)) { return MUS_WAV; }
+		if ((SDL_memcmp(magic, "ID3", 3) == 0) || ((magic[0] == 0xFF) && ((magic[1] & 0xE0) == 0xE0))) { return MUS_MP3; }
+		return MUS_NONE;
+	}
+	static Sint64 _size(SDL_RWops* ops)
+	{
+		return -1;
+	}
+	static Sint64 _seek(SDL_RWops* ops, Sint64 offset, int whence)
+	{
+		// failing every seek, tell included, makes the decoders treat the
+		// source as a live stream
+		return SDL_SetError("Music stream is not seekable");
+	}
+	static size_t _read(SDL_RWops* ops, void* ptr, size_t size, size_t maxnum)
+	{
+		MixMusicStream* stream = (MixMusicStream*) ops->hidden.unknown.data1;
+		if ((size == 0) || (maxnum == 0)) { return 0; }
+		SDL_LockMutex(stream->m_mutex);
+		// neither the load worker nor the audio thread waits for input
+		size_t num = SDL_min(maxnum, (size_t) stream->m_buffered / size);
+		int count = (int) (num * size);
+		int first = SDL_min(count, stream->m_capacity - stream->m_head);
+		SDL_memcpy(ptr, stream->m_data + stream->m_head, first);
+		SDL_memcpy((Uint8*) ptr + first, stream->m_data, count - first);
+		stream->m_head = (stream->m_head + count) % stream->m_capacity;
+		stream->m_buffered -= count;
+		stream->m_consumed += count;
+		bool starve = false;
+		if (stream->m_opened && !stream->m_ended)
+		{
+			if (num == 0) { ++stream->m_underruns; } // the decoder sees the end of the stream
+			if (!stream->m_starved && (stream->m_buffered < stream->m_guard))
+			{
+				stream->m_starved = true;
+				++stream->m_starvations;
+				starve = true;
+			}
+		}
+		if (stream->m_opened) { stream->m_played = s_clock.m_music_position; }
+		bool need = !stream->m_ended && stream->m_need_armed && (stream->m_buffered < stream->m_low);
+		if (need) { stream->m_need_armed = false; }
+		if (starve) { stream->m_starve_pending = true; }
+		if (need) { stream->m_need_pending = true; }
+		SDL_UnlockMutex(stream->m_mutex);
+		if (starve || need) { _audio_event_raise(MIX_EVENT_MUSIC_STREAM); }
+		return num;
+	}
+	static size_t _write(SDL_RWops* ops, const void* ptr, size_t size, size_t num)
+	{
+		SDL_SetError("Music stream is read-only");
+		return 0;
+	}
+	static int _close(SDL_RWops* ops)
+	{
+		MixMusicStream* stream = (MixMusicStream*) ops->hidden.unknown.data1;
+		SDL_LockMutex(stream->m_mutex);
+		stream->m_music = NULL;
+		SDL_UnlockMutex(stream->m_mutex);
+		stream->Release();
+		SDL_FreeRW(ops);
+		return 0;
+	}
+};
 
-class TaskChannelFinished : public Nanx::SimpleTask
+// wrap MixMusicStream pointer; script writes through it and gets events on it
+
+class WrapMusicStream : public Nan::ObjectWrap
 {
 public:
-	int m_channel;
+	MixMusicStream* m_stream;
+	Nan::Persistent<Function> m_callback;
 public:
-	TaskChannelFinished(int channel) : m_channel(channel) {}
-	void DoWork() {}
-	void DoAfterWork(int status)
+	WrapMusicStream(MixMusicStream* stream, Local<Function> callback) : m_stream(stream)
 	{
-		if (!s_channel_finished_callback.IsEmpty())
+		m_stream->m_wrap = this;
+		if (!callback.IsEmpty() && callback->IsFunction()) { m_callback.Reset(callback); }
+	}
+	~WrapMusicStream()
+	{
+		m_callback.Reset();
+		m_stream->m_wrap = NULL;
+		m_stream->End(); // nothing more can be written
+		m_stream->Release(); m_stream = NULL;
+	}
+public:
+	static WrapMusicStream* Unwrap(Local<Value> value) { return (value->IsObject())?(Nan::ObjectWrap::Unwrap<WrapMusicStream>(Local<Object>::Cast(value))):(NULL); }
+	static MixMusicStream* Peek(Local<Value> value) { WrapMusicStream* wrap = Unwrap(value); return (wrap)?(wrap->m_stream):(NULL); }
+public:
+	static Local<Object> NewInstance(MixMusicStream* stream, Local<Function> callback)
+	{
+		Nan::EscapableHandleScope scope;
+		static Nan::Persistent<ObjectTemplate> g_object_template;
+		if (g_object_template.IsEmpty())
 		{
-			Nan::HandleScope scope;
-			Local<Value> argv[] = { Nan::New(m_channel) };
-			Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(s_channel_finished_callback), countof(argv), argv);
+			Local<ObjectTemplate> object_template = Nan::New<ObjectTemplate>();
+			g_object_template.Reset(object_template);
+			object_template->SetInternalFieldCount(1);
 		}
+		Local<Object> instance = Nan::New<ObjectTemplate>(g_object_template)->NewInstance();
+		WrapMusicStream* wrap = new WrapMusicStream(stream, callback);
+		wrap->Wrap(instance);
+		return scope.Escape(instance);
 	}
 };
 
-static void _channel_finished_callback(int channel)
+TaskMusicStreamEvent::TaskMusicStreamEvent(MixMusicStream* stream, int event) : m_stream(stream), m_event(event)
 {
-	int err = Nanx::SimpleTask::Run(new TaskChannelFinished(channel));
+	m_stream->Retain();
 }
 
-// load chunk
+TaskMusicStreamEvent::~TaskMusicStreamEvent()
+{
+	m_stream->Release(); m_stream = NULL;
+}
 
-class Task_MIX_LoadWav : public Nanx::SimpleTask
+void TaskMusicStreamEvent::DoAfterWork(int status)
+{
+	WrapMusicStream* wrap = m_stream->m_wrap;
+	if (wrap && !wrap->m_callback.IsEmpty())
+	{
+		Nan::HandleScope scope;
+		Local<Value> argv[] = { Nan::New(m_event) };
+		Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(wrap->m_callback), countof(argv), argv);
+	}
+}
+
+// main thread, from the audio events
+static void _music_streams_pending(void)
+{
+	for (MixMusicStream* stream = s_music_streams; stream; stream = stream->m_next) { stream->Pending(); }
+}
+
+class Task_MIX_LoadMUS_Stream : public Nanx::SimpleTask
 {
 public:
 	Nan::Persistent<Function> m_callback;
-	char* m_file;
-	Mix_Chunk* m_chunk;
+	MixMusicStream* m_stream;
+	Mix_Music* m_music;
+	bool m_stats;
+	MixLoadTrace m_trace;
 public:
-	Task_MIX_LoadWav(Local<String> file, Local<Function> callback) : 
-		m_file(strdup(*String::Utf8Value(file))), 
-		m_chunk(NULL)
+	Task_MIX_LoadMUS_Stream(MixMusicStream* stream, Local<Function> callback, Local<Value> options) :
+		m_stream(stream),
+		m_music(NULL),
+		m_stats(_option_bool(options, "stats", false))
 	{
+		_load_trace_init(&m_trace);
 		m_callback.Reset(callback);
+		m_stream->Retain();
 	}
-	~Task_MIX_LoadWav()
+	~Task_MIX_LoadMUS_Stream()
 	{
 		m_callback.Reset();
-		free(m_file); m_file = NULL; // strdup
-		if (m_chunk) { Mix_FreeChunk(m_chunk); m_chunk = NULL; }
+		if (m_music) { Mix_FreeMusic(m_music); m_music = NULL; }
+		m_stream->Release(); m_stream = NULL;
 	}
 	void DoWork()
 	{
-		m_chunk = Mix_LoadWAV(m_file);
+		m_trace.m_started = uv_hrtime();
+		m_music = m_stream->Open(&m_trace);
+		m_trace.m_finished = uv_hrtime();
 	}
 	void DoAfterWork(int status)
 	{
 		Nan::HandleScope scope;
-		Local<Value> argv[] = { WrapChunk::Hold(m_chunk) };
-		Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(m_callback), countof(argv), argv);
-		m_chunk = NULL; // script owns pointer
+		_load_trace_count(m_trace, MIX_LOAD_MUSIC, "<stream>", m_music != NULL);
+		Local<Value> argv[] = { WrapMusic::Hold(m_music), (m_stats)?(Local<Value>(_load_trace_object(m_trace, "<stream>"))):(Local<Value>(Nan::Undefined())) };
+		Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(m_callback), (m_stats)?(2):(1), argv);
+		m_music = NULL; // script owns pointer
 	}
 };
 
@@ -183,12 +4172,26 @@ class Task_MIX_LoadMUS : public Nanx::SimpleTask
 public:
 	Nan::Persistent<Function> m_callback;
 	char* m_file;
+	double m_preroll; // ms, or < 0 to decode from the file directly
+	double m_ahead; // ms read ahead of the decoder
+	double m_bitrate; // bits/s, 0 to derive from the file
+	bool m_complete;
 	Mix_Music* m_music;
+	MixMusicPrefetch* m_prefetch;
+	bool m_stats;
+	MixLoadTrace m_trace;
 public:
-	Task_MIX_LoadMUS(Local<String> file, Local<Function> callback) : 
+	Task_MIX_LoadMUS(Local<String> file, Local<Function> callback, Local<Value> options) : 
 		m_file(strdup(*String::Utf8Value(file))), 
-		m_music(NULL)
+		m_preroll(_option_double(options, "preroll", -1.0)),
+		m_ahead(_option_double(options, "ahead", 10000.0)),
+		m_bitrate(_option_double(options, "bitrate", 0.0)),
+		m_complete(_option_bool(options, "complete", false)),
+		m_music(NULL),
+		m_prefetch(NULL),
+		m_stats(_option_bool(options, "stats", false))
 	{
+		_load_trace_init(&m_trace);
 		m_callback.Reset(callback);
 	}
 	~Task_MIX_LoadMUS()
@@ -199,13 +4202,43 @@ public:
 	}
 	void DoWork()
 	{
-		m_music = Mix_LoadMUS(m_file);
+		m_trace.m_started = uv_hrtime();
+		_load();
+		if (m_music) { m_trace.m_decoder = _load_music_decoder(Mix_GetMusicType(m_music)); }
+		m_trace.m_finished = uv_hrtime();
+	}
+	void _load()
+	{
+		if ((m_preroll < 0) && !m_complete)
+		{
+			// open, header reads and decoder setup all happen in Mix_LoadMUS
+			m_music = Mix_LoadMUS(m_file);
+			m_trace.m_decode = _load_ms(m_trace.m_started, uv_hrtime());
+			return;
+		}
+		SDL_RWops* rw = MixMusicPrefetch::Open(m_file, m_preroll, m_ahead, m_bitrate, m_complete);
+		uint64_t decode = uv_hrtime();
+		m_trace.m_open = _load_ms(m_trace.m_started, decode);
+		if (!rw) { return; }
+		MixMusicPrefetch* prefetch = MixMusicPrefetch::Peek(rw);
+		if (prefetch) { m_trace.m_bytes_in = prefetch->m_size; }
+		m_music = Mix_LoadMUS_RW(rw, 1); // closes rw on failure and on Mix_FreeMusic
+		uint64_t preroll = uv_hrtime();
+		m_trace.m_decode = _load_ms(decode, preroll);
+		if (m_music && prefetch)
+		{
+			m_prefetch = prefetch; // lives as long as the music
+			prefetch->Preroll(m_preroll, m_complete);
+			m_trace.m_read = _load_ms(preroll, uv_hrtime()); // reader thread catching up
+		}
 	}
 	void DoAfterWork(int status)
 	{
 		Nan::HandleScope scope;
-		Local<Value> argv[] = { WrapMusic::Hold(m_music) };
-		Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(m_callback), countof(argv), argv);
+		if (m_prefetch) { MixMusicPrefetch::Link(m_prefetch, m_music); }
+		_load_trace_count(m_trace, MIX_LOAD_MUSIC, m_file, m_music != NULL);
+		Local<Value> argv[] = { WrapMusic::Hold(m_music), (m_stats)?(Local<Value>(_load_trace_object(m_trace, m_file))):(Local<Value>(Nan::Undefined())) };
+		Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(m_callback), (m_stats)?(2):(1), argv);
 		m_music = NULL; // script owns pointer
 	}
 };
@@ -227,6 +4260,8 @@ NANX_EXPORT(Mix_Quit)
 {
 	_channel_finished_quit();
 	_music_finished_quit();
+	_adaptive_quit();
+	_sends_quit();
 	Mix_Quit();
 }
 
@@ -248,6 +4283,12 @@ NANX_EXPORT(Mix_OpenAudio)
 	int channels = NANX_int(info[2]);
 	int chunksize = NANX_int(info[3]);
 	int err = Mix_OpenAudio(frequency, format, channels, chunksize);
+	if ((err == 0) && (Mix_QuerySpec(NULL, NULL, NULL) == 1))
+	{
+		// SDL_mixer counts opens; only the first one opens the device
+		_channels_open();
+		_post_effect_init(true);
+	}
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -255,6 +4296,7 @@ NANX_EXPORT(Mix_AllocateChannels)
 {
 	int numchans = NANX_int(info[0]);
 	int err = Mix_AllocateChannels(numchans);
+	if (numchans >= 0) { _channels_resize(err); }
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -273,22 +4315,157 @@ NANX_EXPORT(Mix_QuerySpec)
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
-NANX_EXPORT(Mix_LoadWAV)
+// queue a chunk load, or throw when its options need an open audio device
+static bool _chunk_load(const char* name, Local<Value> file, Local<Function> callback, Local<Value> options, int* err)
+{
+	Task_MIX_LoadWav* task = new Task_MIX_LoadWav(file, callback, options);
+	if ((task->m_analyze || task->m_trim || (task->m_normalize != MIX_NORMALIZE_NONE)) && (task->m_frequency <= 0))
+	{
+		delete task;
+		char message[128];
+		SDL_snprintf(message, sizeof(message), "%s: analysis and transforms need an open audio device", name);
+		Nan::ThrowError(message);
+		return false;
+	}
+	*err = Nanx::SimpleTask::Run(task);
+	return true;
+}
+
+NANX_EXPORT(Mix_LoadWAV)
+{
+	Local<String> file = Local<String>::Cast(info[0]);
+	Local<Function> callback = Local<Function>::Cast(info[1]);
+	Local<Value> options = info[2];
+	int err = 0;
+	if (!_chunk_load("Mix_LoadWAV", file, callback, options, &err)) { return; }
+	info.GetReturnValue().Set(Nan::New(err));
+}
+
+// loads from a Buffer or TypedArray of file bytes, copied before it returns
+NANX_EXPORT(Mix_LoadWAV_RW)
+{
+	Local<Value> data = info[0];
+	Local<Function> callback = Local<Function>::Cast(info[1]);
+	Local<Value> options = info[2];
+	if (!data->IsArrayBufferView()) { Nan::ThrowTypeError("Mix_LoadWAV_RW: expected a Buffer or TypedArray"); return; }
+	int err = 0;
+	if (!_chunk_load("Mix_LoadWAV_RW", data, callback, options, &err)) { return; }
+	info.GetReturnValue().Set(Nan::New(err));
+}
+
+NANX_EXPORT(Mix_LoadMUS)
+{
+	Local<String> file = Local<String>::Cast(info[0]);
+	Local<Function> callback = Local<Function>::Cast(info[1]);
+	Local<Value> options = info[2];
+	int err = Nanx::SimpleTask::Run(new Task_MIX_LoadMUS(file, callback, options));
+	info.GetReturnValue().Set(Nan::New(err));
+}
+
+// reads ms of music after position seconds into memory before a
+// Mix_SetMusicPosition or Mix_FadeInMusicPos there; the byte offset is
+// estimated from the prefetch byte rate, so variable bitrate files get a
+// block of margin before it.  callback(ok) once resident, always
+// asynchronously.  Music loaded without a prefetch (no preroll or complete
+// option) calls back false and returns -1.
+NANX_EXPORT(Mix_PrerollMusic)
+{
+	Mix_Music* music = WrapMusic::Peek(info[0]);
+	double position = NANX_double(info[1]);
+	double ms = NANX_double(info[2]);
+	Local<Function> callback = Local<Function>::Cast(info[3]);
+	MixMusicPrefetch* prefetch = MixMusicPrefetch::Find(music);
+	Sint64 from = 0, to = 0;
+	if (prefetch) { prefetch->Pin(position, ms, &from, &to); }
+	int err = Nanx::SimpleTask::Run(new Task_MIX_PrerollMusic(prefetch, from, to, callback));
+	info.GetReturnValue().Set(Nan::New((prefetch)?(err):(-1)));
+}
+
+// { size, resident, position: bytes, byteRate, stalls } or null without a prefetch
+NANX_EXPORT(Mix_GetMusicPrefetchStats)
+{
+	MixMusicPrefetch* prefetch = MixMusicPrefetch::Find(WrapMusic::Peek(info[0]));
+	if (!prefetch) { info.GetReturnValue().SetNull(); return; }
+	Local<Object> result = Nan::New<Object>();
+	prefetch->Stats(result);
+	info.GetReturnValue().Set(result);
+}
+
+// options { capacity, prebuffer, guard, resume, low: bytes, type: MUS_*, bitrate: bits/s };
+// callback(event) gets Mix_MusicStreamEvent values
+NANX_EXPORT(Mix_CreateMusicStream)
+{
+	Local<Value> options = info[0];
+	Local<Function> callback = Local<Function>::Cast(info[1]);
+	MixMusicStream* stream = new MixMusicStream(options);
+	info.GetReturnValue().Set(WrapMusicStream::NewInstance(stream, callback));
+}
+
+// returns the bytes accepted, fewer than given when the ring is full
+NANX_EXPORT(Mix_WriteMusicStream)
 {
-	Local<String> file = Local<String>::Cast(info[0]);
-	Local<Function> callback = Local<Function>::Cast(info[1]);
-	int err = Nanx::SimpleTask::Run(new Task_MIX_LoadWav(file, callback));
-	info.GetReturnValue().Set(Nan::New(err));
+	MixMusicStream* stream = WrapMusicStream::Peek(info[0]);
+	if (!stream || !info[1]->IsArrayBufferView()) { info.GetReturnValue().Set(Nan::New(0)); return; }
+	Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(info[1]);
+	const Uint8* data = (const Uint8*) view->Buffer()->GetContents().Data() + view->ByteOffset();
+	int count = stream->Write(data, (int) view->ByteLength());
+	info.GetReturnValue().Set(Nan::New(count));
 }
 
-NANX_EXPORT(Mix_LoadWAV_RW) { Nan::ThrowError("TODO"); }
+NANX_EXPORT(Mix_EndMusicStream)
+{
+	MixMusicStream* stream = WrapMusicStream::Peek(info[0]);
+	if (stream) { stream->End(); }
+}
 
-NANX_EXPORT(Mix_LoadMUS)
+NANX_EXPORT(Mix_GetMusicStreamStats)
 {
-	Local<String> file = Local<String>::Cast(info[0]);
+	MixMusicStream* stream = WrapMusicStream::Peek(info[0]);
+	if (!stream) { info.GetReturnValue().SetNull(); return; }
+	Local<Object> result = Nan::New<Object>();
+	stream->Stats(result);
+	info.GetReturnValue().Set(result);
+}
+
+NANX_EXPORT(Mix_LoadMUS_Stream)
+{
+	MixMusicStream* stream = WrapMusicStream::Peek(info[0]);
 	Local<Function> callback = Local<Function>::Cast(info[1]);
-	int err = Nanx::SimpleTask::Run(new Task_MIX_LoadMUS(file, callback));
-	info.GetReturnValue().Set(Nan::New(err));
+	Local<Value> options = info[2];
+	if (!stream) { Nan::ThrowError("Mix_LoadMUS_Stream: not a music stream"); return; }
+	// queued once the prebuffer is written; queueMs includes that wait
+	Task_MIX_LoadMUS_Stream* task = new Task_MIX_LoadMUS_Stream(stream, callback, options);
+	if (!stream->Load(task)) { delete task; Nan::ThrowError("Mix_LoadMUS_Stream: stream already loaded"); return; }
+	info.GetReturnValue().Set(Nan::New(0));
+}
+
+// { chunk: counters, music: counters, slowest: [ { file, kind, decoder, totalMs } ] }
+// counters { loads, failures, queueMs, queueMaxMs, openMs, readMs, decodeMs, processMs, totalMs, totalMaxMs, bytesIn, bytesOut }
+// chunk files are read apart from decoding only for loads with stats on; others count their reads in decodeMs
+NANX_EXPORT(Mix_GetLoadStats)
+{
+	Local<Object> result = Nan::New<Object>();
+	result->Set(NANX_SYMBOL("chunk"), _load_counters_object(s_load_counters[MIX_LOAD_CHUNK]));
+	result->Set(NANX_SYMBOL("music"), _load_counters_object(s_load_counters[MIX_LOAD_MUSIC]));
+	Local<Array> slowest = Nan::New<Array>();
+	for (int i = 0; i < s_load_slow_count; ++i)
+	{
+		const MixLoadSlow& slow = s_load_slow[i];
+		Local<Object> entry = Nan::New<Object>();
+		entry->Set(NANX_SYMBOL("file"), NANX_STRING(slow.m_file));
+		entry->Set(NANX_SYMBOL("kind"), NANX_STRING((slow.m_kind == MIX_LOAD_CHUNK)?("chunk"):("music")));
+		entry->Set(NANX_SYMBOL("decoder"), NANX_STRING(slow.m_decoder));
+		entry->Set(NANX_SYMBOL("totalMs"), Nan::New(slow.m_total));
+		slowest->Set(i, entry);
+	}
+	result->Set(NANX_SYMBOL("slowest"), slowest);
+	info.GetReturnValue().Set(result);
+}
+
+NANX_EXPORT(Mix_ResetLoadStats)
+{
+	SDL_zero(s_load_counters);
+	s_load_slow_count = 0;
 }
 
 NANX_EXPORT(Mix_LoadMUS_RW) { Nan::ThrowError("TODO"); }
@@ -301,8 +4478,91 @@ NANX_EXPORT(Mix_QuickLoad_RAW) { Nan::ThrowError("TODO"); }
 
 NANX_EXPORT(Mix_FreeChunk)
 {
+	WrapChunk* wrap = WrapChunk::Unwrap(info[0]);
 	Mix_Chunk* chunk = WrapChunk::Drop(info[0]);
-	Mix_FreeChunk(chunk);
+	WrapChunk::Free(chunk);
+	if (wrap) { wrap->LeaveArena(); }
+}
+
+NANX_EXPORT(Mix_GetChunkLength)
+{
+	Mix_Chunk* chunk = WrapChunk::Peek(info[0]);
+	info.GetReturnValue().Set(Nan::New((chunk)?(chunk->alen):(0)));
+}
+
+NANX_EXPORT(Mix_GetChunkDuration)
+{
+	Mix_Chunk* chunk = WrapChunk::Peek(info[0]);
+	int frame_size = _audio_frame_size();
+	double ms = 0;
+	if (chunk && (frame_size > 0) && (s_audio_frequency > 0))
+	{
+		ms = (chunk->alen / frame_size) * 1000.0 / s_audio_frequency;
+	}
+	info.GetReturnValue().Set(Nan::New(ms));
+}
+
+NANX_EXPORT(Mix_GetChunkBuffer)
+{
+	WrapChunk* wrap = WrapChunk::Unwrap(info[0]);
+	if (!wrap) { info.GetReturnValue().SetNull(); return; }
+	info.GetReturnValue().Set(wrap->Buffer());
+}
+
+NANX_EXPORT(Mix_GetChunkAnalysis)
+{
+	WrapChunk* wrap = WrapChunk::Unwrap(info[0]);
+	MixChunkAnalysis* analysis = (wrap)?(wrap->Analysis()):(NULL);
+	if (!analysis) { info.GetReturnValue().SetNull(); return; }
+	Local<Object> result = Nan::New<Object>();
+	result->Set(NANX_SYMBOL("peak"), Nan::New(analysis->m_peak));
+	result->Set(NANX_SYMBOL("peakDb"), Nan::New(20.0 * log10(analysis->m_peak)));
+	result->Set(NANX_SYMBOL("rms"), Nan::New(analysis->m_rms));
+	result->Set(NANX_SYMBOL("rmsDb"), Nan::New(20.0 * log10(analysis->m_rms)));
+	result->Set(NANX_SYMBOL("loudness"), Nan::New(analysis->m_loudness));
+	result->Set(NANX_SYMBOL("durationMs"), Nan::New(analysis->m_duration));
+	result->Set(NANX_SYMBOL("leadingSilenceMs"), Nan::New(analysis->m_leading_silence));
+	result->Set(NANX_SYMBOL("trailingSilenceMs"), Nan::New(analysis->m_trailing_silence));
+	if (analysis->m_envelope_size > 0)
+	{
+		size_t size = analysis->m_envelope_size * 2 * sizeof(float);
+		Local<ArrayBuffer> buffer = ArrayBuffer::New(Isolate::GetCurrent(), size);
+		SDL_memcpy(buffer->GetContents().Data(), analysis->m_envelope, size);
+		result->Set(NANX_SYMBOL("envelope"), Float32Array::New(buffer, 0, analysis->m_envelope_size * 2));
+	}
+	info.GetReturnValue().Set(result);
+}
+
+// options { slab: bytes }; pass the arena to Mix_LoadWAV as { arena }
+NANX_EXPORT(Mix_CreateArena)
+{
+	Local<Value> options = info[0];
+	int slab = SDL_max(_option_int(options, "slab", 4 * 1024 * 1024), 64 * 1024);
+	info.GetReturnValue().Set(WrapArena::NewInstance(new MixArena((size_t) slab)));
+}
+
+// halts and frees every chunk loaded into the arena, neuters their buffers
+// and frees the slabs; the arena can take new loads afterwards
+NANX_EXPORT(Mix_ReleaseArena)
+{
+	MixArena* arena = WrapArena::Peek(info[0]);
+	if (arena) { arena->Clear(); }
+}
+
+NANX_EXPORT(Mix_GetArenaStats)
+{
+	MixArena* arena = WrapArena::Peek(info[0]);
+	if (!arena) { info.GetReturnValue().SetNull(); return; }
+	double reserved = (double) arena->Reserved();
+	double used = (double) arena->Used();
+	double live = (double) arena->m_live;
+	Local<Object> result = Nan::New<Object>();
+	result->Set(NANX_SYMBOL("chunks"), Nan::New(arena->m_chunks));
+	result->Set(NANX_SYMBOL("reserved"), Nan::New(reserved));
+	result->Set(NANX_SYMBOL("used"), Nan::New(used));
+	result->Set(NANX_SYMBOL("live"), Nan::New(live));
+	result->Set(NANX_SYMBOL("utilization"), Nan::New((reserved > 0)?(live / reserved):(0.0)));
+	info.GetReturnValue().Set(result);
 }
 
 NANX_EXPORT(Mix_FreeMusic)
@@ -370,6 +4630,13 @@ NANX_EXPORT(Mix_UnregisterAllEffects)
 {
 	int channel = NANX_int(info[0]);
 	int err = Mix_UnregisterAllEffects(channel);
+	SDL_LockAudio();
+	MixChannel* state = _channel(channel);
+	if (state)
+	{
+		for (int call = 0; call < MIX_POSITION_CALL_COUNT; ++call) { state->m_position_call[call] = 0; }
+	}
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -378,7 +4645,16 @@ NANX_EXPORT(Mix_SetPanning)
 	int channel = NANX_int(info[0]);
 	::Uint8 left = NANX_Uint8(info[1]);
 	::Uint8 right = NANX_Uint8(info[2]);
+	if (_channel_position_refused(channel)) { info.GetReturnValue().Set(Nan::New(0)); return; }
 	int err = Mix_SetPanning(channel, left, right);
+	MixChannel* state = _channel(channel);
+	if (err && state)
+	{
+		state->m_position_call[MIX_CALL_PANNING] = ++s_position_call_stamp;
+		state->m_panning_left = left;
+		state->m_panning_right = right;
+		_channel_send_last(channel);
+	}
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -387,7 +4663,16 @@ NANX_EXPORT(Mix_SetPosition)
 	int channel = NANX_int(info[0]);
 	::Sint16 angle = NANX_Sint16(info[1]);
 	::Uint8 distance = NANX_Uint8(info[2]);
+	if (_channel_position_refused(channel)) { info.GetReturnValue().Set(Nan::New(0)); return; }
 	int err = Mix_SetPosition(channel, angle, distance);
+	MixChannel* state = _channel(channel);
+	if (err && state)
+	{
+		state->m_position_call[MIX_CALL_POSITION] = ++s_position_call_stamp;
+		state->m_position_angle = angle;
+		state->m_position_distance = distance;
+		_channel_send_last(channel);
+	}
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -395,7 +4680,15 @@ NANX_EXPORT(Mix_SetDistance)
 {
 	int channel = NANX_int(info[0]);
 	::Uint8 distance = NANX_Uint8(info[1]);
+	if (_channel_position_refused(channel)) { info.GetReturnValue().Set(Nan::New(0)); return; }
 	int err = Mix_SetDistance(channel, distance);
+	MixChannel* state = _channel(channel);
+	if (err && state)
+	{
+		state->m_position_call[MIX_CALL_DISTANCE] = ++s_position_call_stamp;
+		state->m_distance = distance;
+		_channel_send_last(channel);
+	}
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -403,7 +4696,15 @@ NANX_EXPORT(Mix_SetReverseStereo)
 {
 	int channel = NANX_int(info[0]);
 	int flip = NANX_Sint16(info[1]);
+	if (_channel_position_refused(channel)) { info.GetReturnValue().Set(Nan::New(0)); return; }
 	int err = Mix_SetReverseStereo(channel, flip);
+	MixChannel* state = _channel(channel);
+	if (err && state)
+	{
+		state->m_position_call[MIX_CALL_REVERSE_STEREO] = ++s_position_call_stamp;
+		state->m_reverse_stereo = flip;
+		_channel_send_last(channel);
+	}
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -411,6 +4712,7 @@ NANX_EXPORT(Mix_ReserveChannels)
 {
 	int num = NANX_int(info[0]);
 	int err = Mix_ReserveChannels(num);
+	s_channel_reserved = err;
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -419,6 +4721,15 @@ NANX_EXPORT(Mix_GroupChannel)
 	int channel = NANX_int(info[0]);
 	int tag = NANX_int(info[1]);
 	int err = Mix_GroupChannel(channel, tag);
+	if (err)
+	{
+		SDL_LockAudio();
+		for (int i = 0; i < s_channel_count; ++i)
+		{
+			if ((channel == -1) || (channel == i)) { s_channels[i].m_tag = tag; }
+		}
+		SDL_UnlockAudio();
+	}
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -428,6 +4739,9 @@ NANX_EXPORT(Mix_GroupChannels)
 	int to = NANX_int(info[1]);
 	int tag = NANX_int(info[2]);
 	int err = Mix_GroupChannels(from, to, tag);
+	SDL_LockAudio();
+	for (int i = SDL_max(from, 0); (i <= to) && (i < s_channel_count); ++i) { s_channels[i].m_tag = tag; }
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -464,7 +4778,7 @@ NANX_EXPORT(Mix_PlayChannel)
 	int channel = NANX_int(info[0]);
 	Mix_Chunk* chunk = WrapChunk::Peek(info[1]);
 	int loops = NANX_int(info[2]);
-	int err = Mix_PlayChannel(channel, chunk, loops);
+	int err = _channel_play(channel, chunk, loops, -1, -1);
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -474,7 +4788,7 @@ NANX_EXPORT(Mix_PlayChannelTimed)
 	Mix_Chunk* chunk = WrapChunk::Peek(info[1]);
 	int loops = NANX_int(info[2]);
 	int ticks = NANX_int(info[3]);
-	int err = Mix_PlayChannelTimed(channel, chunk, loops, ticks);
+	int err = _channel_play(channel, chunk, loops, -1, ticks);
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -482,7 +4796,11 @@ NANX_EXPORT(Mix_PlayMusic)
 {
 	Mix_Music* music = WrapMusic::Peek(info[0]);
 	int loops = NANX_int(info[1]);
+	SDL_LockAudio();
+	s_music_starved = NULL;
 	int err = Mix_PlayMusic(music, loops);
+	if (err == 0) { _clock_music_seek(music, 0); s_music_current = music; s_music_loops = loops; }
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -491,7 +4809,11 @@ NANX_EXPORT(Mix_FadeInMusic)
 	Mix_Music* music = WrapMusic::Peek(info[0]);
 	int loops = NANX_int(info[1]);
 	int ms = NANX_int(info[2]);
+	SDL_LockAudio();
+	s_music_starved = NULL;
 	int err = Mix_FadeInMusic(music, loops, ms);
+	if (err == 0) { _clock_music_seek(music, 0); s_music_current = music; s_music_loops = loops; }
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -501,7 +4823,11 @@ NANX_EXPORT(Mix_FadeInMusicPos)
 	int loops = NANX_int(info[1]);
 	int ms = NANX_int(info[2]);
 	double position = NANX_double(info[3]);
+	SDL_LockAudio();
+	s_music_starved = NULL;
 	int err = Mix_FadeInMusicPos(music, loops, ms, position);
+	if (err == 0) { _clock_music_seek(music, position); s_music_current = music; s_music_loops = loops; }
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -511,7 +4837,7 @@ NANX_EXPORT(Mix_FadeInChannel)
 	Mix_Chunk* chunk = WrapChunk::Peek(info[1]);
 	int loops = NANX_int(info[2]);
 	int ms = NANX_int(info[3]);
-	int err = Mix_FadeInChannel(channel, chunk, loops, ms);
+	int err = _channel_play(channel, chunk, loops, ms, -1);
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -522,7 +4848,7 @@ NANX_EXPORT(Mix_FadeInChannelTimed)
 	int loops = NANX_int(info[2]);
 	int ms = NANX_int(info[3]);
 	int ticks = NANX_int(info[4]);
-	int err = Mix_FadeInChannelTimed(channel, chunk, loops, ms, ticks);
+	int err = _channel_play(channel, chunk, loops, ms, ticks);
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -545,27 +4871,384 @@ NANX_EXPORT(Mix_VolumeChunk)
 NANX_EXPORT(Mix_VolumeMusic)
 {
 	int volume = NANX_int(info[0]);
-	int err = Mix_VolumeMusic(volume);
+	SDL_LockAudio();
+	int err = Mix_VolumeMusic(-1);
+	if (volume >= 0)
+	{
+		s_music_volume = SDL_min(volume, MIX_MAX_VOLUME);
+		s_music_volume_applied = -1;
+		if (_music_volume_managed()) { _music_volume_apply(); }
+		else { Mix_VolumeMusic(s_music_volume); }
+	}
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
+// gain is linear; tag MIX_BUS_MUSIC addresses the music
+NANX_EXPORT(Mix_SetBusGain)
+{
+	int tag = NANX_int(info[0]);
+	double gain = SDL_max(0.0, NANX_double(info[1]));
+	SDL_LockAudio();
+	MixBus* bus = _bus(tag, true);
+	if (bus) { bus->m_gain = gain; }
+	if (bus && (tag == MIX_BUS_MUSIC)) { _music_volume_apply(); }
+	SDL_UnlockAudio();
+	if (!bus) { Mix_SetError("Too many buses"); }
+	info.GetReturnValue().Set(Nan::New((bus)?(1):(0)));
+}
+
+// current gain including ducking
+NANX_EXPORT(Mix_GetBusGain)
+{
+	int tag = NANX_int(info[0]);
+	SDL_LockAudio();
+	float gain = _bus_gain(tag);
+	SDL_UnlockAudio();
+	info.GetReturnValue().Set(Nan::New((double) gain));
+}
+
+// { source: tag, target: tag | [tags], depth: dB, attack: ms, release: ms };
+// a MIX_BUS_MUSIC target ducks in Mix_VolumeMusic steps, once per buffer
+NANX_EXPORT(Mix_AddDuckRule)
+{
+	Local<Value> options = info[0];
+	MixDuckRule rule;
+	SDL_zero(rule);
+	rule.m_source = _option_int(options, "source", -1);
+	Local<Value> target = _option(options, "target");
+	if (target->IsArray())
+	{
+		Local<Array> targets = Local<Array>::Cast(target);
+		for (uint32_t i = 0; (i < targets->Length()) && (rule.m_target_count < MixDuckRule::k_max_targets); ++i)
+		{
+			rule.m_targets[rule.m_target_count++] = NANX_int(targets->Get(i));
+		}
+	}
+	else
+	{
+		rule.m_targets[rule.m_target_count++] = _option_int(options, "target", MIX_BUS_MUSIC);
+	}
+	rule.m_depth = pow(10.0, -fabs(_option_double(options, "depth", 12.0)) / 20.0);
+	rule.m_attack = SDL_max(0.0, _option_double(options, "attack", 50.0)) / 1000.0;
+	rule.m_release = SDL_max(0.0, _option_double(options, "release", 500.0)) / 1000.0;
+	int id = 0;
+	SDL_LockAudio();
+	// check for a free rule and room for every missing target bus before
+	// anything is created, so a refused rule leaves no buses behind
+	MixDuckRule* slot = NULL;
+	for (int r = 0; (r < k_max_duck_rules) && !slot; ++r)
+	{
+		if (s_duck_rules[r].m_id == 0) { slot = &s_duck_rules[r]; }
+	}
+	int missing = 0, unused = 0;
+	for (int t = 0; t < rule.m_target_count; ++t)
+	{
+		bool seen = (_bus(rule.m_targets[t], false) != NULL);
+		for (int u = 0; (u < t) && !seen; ++u) { seen = (rule.m_targets[u] == rule.m_targets[t]); }
+		if (!seen) { ++missing; }
+	}
+	for (int i = 0; i < k_max_buses; ++i) { if (!s_buses[i].m_used) { ++unused; } }
+	if (!slot) { Mix_SetError("Too many duck rules"); }
+	else if (missing > unused) { Mix_SetError("Too many buses"); }
+	else
+	{
+		// the audio thread only looks buses up, so the targets exist first
+		for (int t = 0; t < rule.m_target_count; ++t) { _bus(rule.m_targets[t], true); }
+		id = rule.m_id = s_duck_rule_next_id++;
+		*slot = rule;
+	}
+	SDL_UnlockAudio();
+	info.GetReturnValue().Set(Nan::New(id));
+}
+
+// id, or -1 for all rules
+NANX_EXPORT(Mix_RemoveDuckRule)
+{
+	int id = NANX_int(info[0]);
+	int count = 0;
+	SDL_LockAudio();
+	for (int r = 0; r < k_max_duck_rules; ++r)
+	{
+		if ((s_duck_rules[r].m_id != 0) && ((id == -1) || (s_duck_rules[r].m_id == id)))
+		{
+			SDL_zero(s_duck_rules[r]);
+			++count;
+		}
+	}
+	SDL_UnlockAudio();
+	info.GetReturnValue().Set(Nan::New(count));
+}
+
+// send, impulse response, options { partition: frames, gain: linear,
+// channels: of a Float32Array or ArrayBuffer IR }; the IR is a chunk in the
+// device format or interleaved float at the device rate, mono or stereo, and
+// null removes the reverb
+NANX_EXPORT(Mix_SetReverb)
+{
+	int send = NANX_int(info[0]);
+	Local<Value> ir = info[1];
+	Local<Value> options = info[2];
+	if ((send < 0) || (send >= MIX_MAX_SENDS)) { Mix_SetError("Invalid send number"); info.GetReturnValue().Set(Nan::New(0)); return; }
+	MixReverb* reverb = NULL;
+	if (!ir->IsNull() && !ir->IsUndefined())
+	{
+		int partition = 64;
+		while ((partition < 8192) && (partition < _option_int(options, "partition", 512))) { partition *= 2; }
+		float gain = (float) SDL_max(0.0, _option_double(options, "gain", 1.0));
+		float* samples = NULL;
+		int frames = 0;
+		int channels = 0;
+		Mix_Chunk* chunk = WrapChunk::Peek(ir);
+		if (chunk && (_audio_frame_size() > 0))
+		{
+			channels = s_audio_channels;
+			frames = (int) (chunk->alen / _audio_frame_size());
+			samples = new float[(size_t) frames * channels];
+			_pcm_to_float(chunk->abuf, samples, frames * channels, s_audio_format);
+		}
+		else if (ir->IsArrayBufferView() || ir->IsArrayBuffer())
+		{
+			channels = SDL_max(1, _option_int(options, "channels", 1));
+			size_t size = (ir->IsArrayBuffer())?(Local<ArrayBuffer>::Cast(ir)->ByteLength()):(Local<ArrayBufferView>::Cast(ir)->ByteLength());
+			frames = (int) (size / (sizeof(float) * channels));
+			samples = new float[(size_t) frames * channels];
+			if (ir->IsArrayBuffer()) { SDL_memcpy(samples, Local<ArrayBuffer>::Cast(ir)->GetContents().Data(), (size_t) frames * channels * sizeof(float)); }
+			else { Local<ArrayBufferView>::Cast(ir)->CopyContents(samples, (size_t) frames * channels * sizeof(float)); }
+		}
+		if (!samples || (frames <= 0))
+		{
+			delete[] samples;
+			Mix_SetError((chunk)?("Audio device not open"):("Invalid impulse response"));
+			info.GetReturnValue().Set(Nan::New(0));
+			return;
+		}
+		reverb = new MixReverb(samples, frames, channels, partition, gain);
+		delete[] samples;
+		if (!reverb->m_thread)
+		{
+			delete reverb;
+			info.GetReturnValue().Set(Nan::New(0));
+			return;
+		}
+	}
+	SDL_LockAudio();
+	MixReverb* previous = s_sends[send];
+	s_sends[send] = reverb;
+	SDL_UnlockAudio();
+	delete previous;
+	info.GetReturnValue().Set(Nan::New(1));
+}
+
+// channel, or -1 for all; send; level is linear
+NANX_EXPORT(Mix_SetChannelSend)
+{
+	int channel = NANX_int(info[0]);
+	int send = NANX_int(info[1]);
+	float level = (float) SDL_max(0.0, NANX_double(info[2]));
+	int first = (channel < 0)?(0):(channel);
+	int last = (channel < 0)?(s_channel_count - 1):(channel);
+	if ((send < 0) || (send >= MIX_MAX_SENDS) || !_channel(first) || !_channel(last))
+	{
+		Mix_SetError("Invalid channel or send number");
+		info.GetReturnValue().Set(Nan::New(0));
+		return;
+	}
+	SDL_LockAudio();
+	for (int i = first; i <= last; ++i) { s_channels[i].m_send[send] = level; }
+	SDL_UnlockAudio();
+	info.GetReturnValue().Set(Nan::New(1));
+}
+
+NANX_EXPORT(Mix_GetChannelSend)
+{
+	int channel = NANX_int(info[0]);
+	int send = NANX_int(info[1]);
+	MixChannel* state = _channel(channel);
+	double level = (state && (send >= 0) && (send < MIX_MAX_SENDS))?(state->m_send[send]):(0.0);
+	info.GetReturnValue().Set(Nan::New(level));
+}
+
+NANX_EXPORT(Mix_GetReverbStats)
+{
+	int send = NANX_int(info[0]);
+	if ((send < 0) || (send >= MIX_MAX_SENDS)) { info.GetReturnValue().SetNull(); return; }
+	SDL_LockAudio();
+	MixReverb* reverb = s_sends[send];
+	int dropped = (reverb)?(reverb->m_dropped):(0);
+	int missed = (reverb)?(reverb->m_missed):(0);
+	bool primed = reverb && reverb->m_primed;
+	SDL_UnlockAudio();
+	if (!reverb) { info.GetReturnValue().SetNull(); return; }
+	Local<Object> result = Nan::New<Object>();
+	result->Set(NANX_SYMBOL("partition"), Nan::New(reverb->m_partition));
+	result->Set(NANX_SYMBOL("partitions"), Nan::New(reverb->m_partitions));
+	result->Set(NANX_SYMBOL("stereo"), Nan::New(reverb->m_stereo));
+	result->Set(NANX_SYMBOL("blocks"), Nan::New(SDL_AtomicGet(&reverb->m_blocks)));
+	result->Set(NANX_SYMBOL("primed"), Nan::New(primed));
+	result->Set(NANX_SYMBOL("dropped"), Nan::New(dropped));
+	result->Set(NANX_SYMBOL("missed"), Nan::New(missed));
+	info.GetReturnValue().Set(result);
+}
+
+// rate <= 0 turns resampling off from the next play; changes to a playing
+// channel glide over ms
+NANX_EXPORT(Mix_SetPlaybackRate)
+{
+	int channel = NANX_int(info[0]);
+	double rate = NANX_double(info[1]);
+	double ms = (info[2]->IsNumber())?(NANX_double(info[2])):(20.0);
+	double frames = SDL_max(1.0, ms * s_audio_frequency / 1000.0);
+	int first = (channel < 0)?(0):(channel);
+	int last = (channel < 0)?(s_channel_count - 1):(channel);
+	if (!_channel(first) || !_channel(last))
+	{
+		Mix_SetError("Invalid channel number");
+		info.GetReturnValue().Set(Nan::New(0));
+		return;
+	}
+	SDL_LockAudio();
+	for (int i = first; i <= last; ++i)
+	{
+		MixChannel* state = _channel(i);
+		state->m_rate_enabled = (rate > 0);
+		state->m_rate_target = (rate > 0)?(SDL_max(1.0 / 16.0, SDL_min(rate, 16.0))):(1.0);
+		state->m_rate_coeff = 1.0 - exp(-1.0 / frames);
+		if (!state->m_rate_active) { state->m_rate = state->m_rate_target; }
+		if (state->m_rate_enabled) { s_channel_rate_any = true; }
+	}
+	SDL_UnlockAudio();
+	info.GetReturnValue().Set(Nan::New(1));
+}
+
+NANX_EXPORT(Mix_GetPlaybackRate)
+{
+	int channel = NANX_int(info[0]);
+	MixChannel* state = _channel(channel);
+	double rate = (state && state->m_rate_enabled)?(state->m_rate_target):(1.0);
+	info.GetReturnValue().Set(Nan::New(rate));
+}
+
+// channel, or MIX_BUS_MUSIC (volume only); points is [ms, value, ms, value, ...]
+// with volume as a linear gain and pan in [-1, 1]
+NANX_EXPORT(Mix_SetEnvelope)
+{
+	int channel = NANX_int(info[0]);
+	int param = NANX_int(info[1]);
+	Local<Array> points = Local<Array>::Cast(info[2]);
+	int curve = (info[3]->IsNumber())?(NANX_int(info[3])):(MIX_CURVE_LINEAR);
+	MixChannel* state = _channel(channel);
+	if ((param < 0) || (param >= MIX_ENVELOPE_PARAM_COUNT) || ((channel == MIX_BUS_MUSIC) && (param != MIX_ENVELOPE_VOLUME)))
+	{
+		Mix_SetError("Invalid envelope parameter");
+		info.GetReturnValue().Set(Nan::New(0));
+		return;
+	}
+	if (!state && (channel != MIX_BUS_MUSIC))
+	{
+		Mix_SetError("Invalid channel number");
+		info.GetReturnValue().Set(Nan::New(0));
+		return;
+	}
+	MixEnvelope envelope;
+	SDL_zero(envelope);
+	envelope.m_active = true;
+	envelope.m_curve = (MixEnvelopeCurve) SDL_max((int) MIX_CURVE_LINEAR, SDL_min(curve, (int) MIX_CURVE_EQUAL_POWER));
+	for (uint32_t i = 0; (i + 1 < points->Length()) && (envelope.m_count < MixEnvelope::k_max_points); i += 2)
+	{
+		double time = NANX_double(points->Get(i)) / 1000.0;
+		if ((envelope.m_count > 0) && (time < envelope.m_time[envelope.m_count - 1])) { time = envelope.m_time[envelope.m_count - 1]; }
+		envelope.m_time[envelope.m_count] = time;
+		envelope.m_value[envelope.m_count] = NANX_double(points->Get(i + 1));
+		envelope.m_count++;
+	}
+	if (envelope.m_count == 0)
+	{
+		Mix_SetError("Envelope has no points");
+		info.GetReturnValue().Set(Nan::New(0));
+		return;
+	}
+	// an idle channel holds the envelope at its start until it plays
+	MixEnvelope** slot = (state)?(&state->m_envelope[param]):(&s_music_envelope);
+	MixEnvelope* storage = new MixEnvelope(envelope);
+	SDL_LockAudio();
+	MixEnvelope* previous = *slot;
+	*slot = storage;
+	if (!state) { _music_volume_apply(); }
+	SDL_UnlockAudio();
+	delete previous;
+	info.GetReturnValue().Set(Nan::New(1));
+}
+
+NANX_EXPORT(Mix_ClearEnvelope)
+{
+	int channel = NANX_int(info[0]);
+	int param = NANX_int(info[1]);
+	MixChannel* state = _channel(channel);
+	if ((param < 0) || (param >= MIX_ENVELOPE_PARAM_COUNT) || (!state && (channel != MIX_BUS_MUSIC))) { return; }
+	SDL_LockAudio();
+	MixEnvelope** slot = (state)?(&state->m_envelope[param]):(&s_music_envelope);
+	if (*slot) { (*slot)->m_active = false; }
+	if (!state) { _music_volume_apply(); }
+	SDL_UnlockAudio();
+}
+
+// Halts, fade outs and expiries from script are noted per channel: an engine
+// voice cannot tell them from the natural end of its stand-in.  Channel -1
+// reaches every channel; group calls pass their tag.
+static bool _channel_reached(int i, int channel, bool group, int tag)
+{
+	if (group) { return s_channels[i].m_tag == tag; }
+	return (channel == -1) || (i == channel);
+}
+
+// called with the audio device locked, before the halt
+static void _channels_halting(int channel, bool group, int tag)
+{
+	for (int i = 0; i < s_channel_count; ++i)
+	{
+		if (_channel_reached(i, channel, group, tag) && s_channels[i].m_attached) { s_channels[i].m_halted = true; }
+	}
+}
+
+// called with the audio device locked, after the fade out started
+static void _channels_fading_out(int channel, bool group, int tag, int ms)
+{
+	Uint32 end = SDL_max(SDL_GetTicks() + (Uint32) SDL_max(ms, 0), 1u);
+	for (int i = 0; i < s_channel_count; ++i)
+	{
+		MixChannel* state = &s_channels[i];
+		if (!_channel_reached(i, channel, group, tag) || !state->m_attached || (state->m_fade_out != 0)) { continue; }
+		if (Mix_FadingChannel(i) == MIX_FADING_OUT) { state->m_fade_out = end; }
+	}
+}
+
 NANX_EXPORT(Mix_HaltChannel)
 {
 	int channel = NANX_int(info[0]);
+	SDL_LockAudio();
+	_channels_halting(channel, false, 0);
 	int err = Mix_HaltChannel(channel);
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
 NANX_EXPORT(Mix_HaltGroup)
 {
 	int tag = NANX_int(info[0]);
+	SDL_LockAudio();
+	_channels_halting(-1, true, tag);
 	int err = Mix_HaltGroup(tag);
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
 NANX_EXPORT(Mix_HaltMusic)
 {
+	SDL_LockAudio();
+	s_music_starved = NULL;
 	int err = Mix_HaltMusic();
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -573,7 +5256,14 @@ NANX_EXPORT(Mix_ExpireChannel)
 {
 	int channel = NANX_int(info[0]);
 	int ticks = NANX_int(info[1]);
+	SDL_LockAudio();
 	int err = Mix_ExpireChannel(channel, ticks);
+	Uint32 expire = (ticks > 0)?(SDL_max(SDL_GetTicks() + ticks, 1u)):(0);
+	for (int i = 0; i < s_channel_count; ++i)
+	{
+		if (_channel_reached(i, channel, false, 0)) { s_channels[i].m_expire = expire; }
+	}
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -581,7 +5271,10 @@ NANX_EXPORT(Mix_FadeOutChannel)
 {
 	int channel = NANX_int(info[0]);
 	int ms = NANX_int(info[1]);
+	SDL_LockAudio();
 	int err = Mix_FadeOutChannel(channel, ms);
+	_channels_fading_out(channel, false, 0, ms);
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -589,7 +5282,10 @@ NANX_EXPORT(Mix_FadeOutGroup)
 {
 	int tag = NANX_int(info[0]);
 	int ms = NANX_int(info[1]);
+	SDL_LockAudio();
 	int err = Mix_FadeOutGroup(tag, ms);
+	_channels_fading_out(-1, true, tag, ms);
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
@@ -644,7 +5340,10 @@ NANX_EXPORT(Mix_ResumeMusic)
 
 NANX_EXPORT(Mix_RewindMusic)
 {
+	SDL_LockAudio();
 	Mix_RewindMusic();
+	_clock_music_seek(NULL, 0);
+	SDL_UnlockAudio();
 }
 
 NANX_EXPORT(Mix_PausedMusic)
@@ -656,10 +5355,23 @@ NANX_EXPORT(Mix_PausedMusic)
 NANX_EXPORT(Mix_SetMusicPosition)
 {
 	double position = NANX_double(info[0]);
+	SDL_LockAudio();
 	int err = Mix_SetMusicPosition(position);
+	if (err == 0) { _clock_music_seek(NULL, position); }
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(Nan::New(err));
 }
 
+// length in seconds of the music now playing, for wrapping the clock's music
+// position when it loops; SDL_mixer 2.6 and later report it on play
+NANX_EXPORT(Mix_SetMusicLength)
+{
+	double length = NANX_double(info[0]);
+	SDL_LockAudio();
+	s_clock_music_length = SDL_max(0.0, length);
+	SDL_UnlockAudio();
+}
+
 NANX_EXPORT(Mix_Playing)
 {
 	int channel = NANX_int(info[0]);
@@ -742,17 +5454,372 @@ NANX_EXPORT(Mix_EachSoundFont)
 NANX_EXPORT(Mix_GetChunk)
 {
 	int channel = NANX_int(info[0]);
+	SDL_LockAudio();
 	Mix_Chunk* chunk = Mix_GetChunk(channel);
+	MixChannel* state = _channel(channel);
+	if (state && chunk && (chunk == state->m_standin)) { chunk = state->m_chunk; }
+	SDL_UnlockAudio();
 	info.GetReturnValue().Set(WrapChunk::Hold(chunk));
 }
 
 NANX_EXPORT(Mix_CloseAudio)
 {
 	Mix_CloseAudio();
+	if (Mix_QuerySpec(NULL, NULL, NULL) != 0) { return; } // still open for an earlier Mix_OpenAudio
+	_post_effect_quit();
+	_channels_close();
+	s_channel_reserved = 0;
+}
+
+// options for the audio thread, applied again to each new audio thread
+static Nan::Persistent<Value> s_audio_thread_options;
+static Nan::Persistent<Function> s_audio_thread_callback;
+static long s_audio_thread_applied = 0; // tid the options went to
+
+static int _audio_thread_policy(Local<Value> policy)
+{
+	#if defined(__linux__)
+	if (!policy->IsString()) { return -1; }
+	String::Utf8Value name(policy);
+	if (strcmp(*name, "other") == 0) { return SCHED_OTHER; }
+	if (strcmp(*name, "fifo") == 0) { return SCHED_FIFO; }
+	if (strcmp(*name, "rr") == 0) { return SCHED_RR; }
+	#endif
+	return -1;
+}
+
+static Local<Object> _audio_thread_apply(Local<Value> options, long tid)
+{
+	Nan::EscapableHandleScope scope;
+	Local<Object> result = Nan::New<Object>();
+	result->Set(NANX_SYMBOL("tid"), Nan::New((double) tid));
+	#if defined(__linux__)
+	int sched = _audio_thread_policy(_option(options, "policy"));
+	if (sched >= 0)
+	{
+		struct sched_param param;
+		SDL_zero(param);
+		if (sched != SCHED_OTHER)
+		{
+			int priority = _option_int(options, "priority", sched_get_priority_min(sched));
+			param.sched_priority = SDL_max(sched_get_priority_min(sched), SDL_min(priority, sched_get_priority_max(sched)));
+		}
+		int err = sched_setscheduler((pid_t) tid, sched, &param);
+		result->Set(NANX_SYMBOL("sched"), Nan::New(err == 0));
+		result->Set(NANX_SYMBOL("priority"), Nan::New(param.sched_priority));
+		if (err != 0) { result->Set(NANX_SYMBOL("schedError"), NANX_STRING(strerror(errno))); }
+	}
+	Local<Value> cpus = _option(options, "cpus");
+	if (cpus->IsArray())
+	{
+		Local<Array> array = Local<Array>::Cast(cpus);
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (uint32_t index = 0; index < array->Length(); ++index)
+		{
+			int cpu = NANX_int(array->Get(index));
+			if ((cpu >= 0) && (cpu < CPU_SETSIZE)) { CPU_SET(cpu, &set); }
+		}
+		int err = sched_setaffinity((pid_t) tid, sizeof(set), &set);
+		result->Set(NANX_SYMBOL("affinity"), Nan::New(err == 0));
+		if (err != 0) { result->Set(NANX_SYMBOL("affinityError"), NANX_STRING(strerror(errno))); }
+	}
+	#else
+	result->Set(NANX_SYMBOL("error"), NANX_STRING("unsupported platform"));
+	#endif
+	return scope.Escape(result);
+}
+
+// main thread, once a new audio thread has mixed its first buffer
+static void _audio_thread_ready(void)
+{
+	SDL_LockAudio();
+	long tid = s_audio_thread.m_tid;
+	SDL_UnlockAudio();
+	if ((tid == 0) || (tid == s_audio_thread_applied) || s_audio_thread_options.IsEmpty()) { return; }
+	Nan::HandleScope scope;
+	s_audio_thread_applied = tid;
+	Local<Value> argv[] = { _audio_thread_apply(Nan::New<Value>(s_audio_thread_options), tid) };
+	if (!s_audio_thread_callback.IsEmpty())
+	{
+		Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New<Function>(s_audio_thread_callback), countof(argv), argv);
+	}
+}
+
+static void _audio_events_drain(uv_async_t* handle)
+{
+	int events = SDL_AtomicSet(&s_audio_events, 0);
+	if (events & MIX_EVENT_THREAD) { _audio_thread_ready(); }
+	if (events & MIX_EVENT_CHANNEL_HALT) { _channels_halt_pending(); }
+	if (events & MIX_EVENT_ENVELOPE) { _envelopes_done_pending(); }
+	if (events & MIX_EVENT_MUSIC_STREAM) { _music_streams_pending(); }
+	if (events & MIX_EVENT_ADAPTIVE) { _adaptive_pending(); }
+}
+
+// options { policy: "other" | "fifo" | "rr", priority, cpus: [ cpu ], mlock };
+// the thread options are kept and applied to every audio thread SDL starts,
+// including after Mix_CloseAudio and adaptive buffer reopens; null options
+// forget them.  Returns what took effect: the thread settings only once the
+// audio thread has mixed a buffer, null before; callback(result) gets each
+// later application.  mlock locks the PCM of loaded chunks, and of chunks
+// loaded later, in RAM; false unlocks it.
+NANX_EXPORT(Mix_SetAudioThreadOptions)
+{
+	Local<Value> options = info[0];
+	Local<Value> callback = info[1];
+	Local<Value> policy = _option(options, "policy");
+	if (!policy->IsUndefined() && (_audio_thread_policy(policy) < 0))
+	{
+		Nan::ThrowError("Mix_SetAudioThreadOptions: unknown policy");
+		return;
+	}
+	s_audio_thread_options.Reset();
+	s_audio_thread_callback.Reset();
+	s_audio_thread_applied = 0;
+	if (!options->IsObject()) { info.GetReturnValue().SetNull(); return; }
+	s_audio_thread_options.Reset(options);
+	if (callback->IsFunction()) { s_audio_thread_callback.Reset(Local<Function>::Cast(callback)); }
+	SDL_LockAudio();
+	long tid = s_audio_thread.m_tid;
+	SDL_UnlockAudio();
+	Local<Value> result = Nan::Null();
+	if (tid != 0)
+	{
+		s_audio_thread_applied = tid;
+		result = _audio_thread_apply(options, tid);
+	}
+	Local<Value> mlock = _option(options, "mlock");
+	if (!mlock->IsUndefined())
+	{
+		int error = 0;
+		size_t bytes = WrapChunk::LockAll(mlock->BooleanValue(), &error);
+		if (!result->IsObject()) { result = Nan::New<Object>(); }
+		Local<Object> object = Local<Object>::Cast(result);
+		object->Set(NANX_SYMBOL("mlock"), Nan::New(error == 0));
+		object->Set(NANX_SYMBOL("mlockBytes"), Nan::New((double) bytes));
+		if (error != 0) { object->Set(NANX_SYMBOL("mlockError"), NANX_STRING(strerror(error))); }
+	}
+	info.GetReturnValue().Set(result);
+}
+
+NANX_EXPORT(Mix_GetAudioThreadStats)
+{
+	SDL_LockAudio();
+	MixAudioThreadStats stats = s_audio_thread;
+	SDL_UnlockAudio();
+	double count = (stats.m_callbacks > 0)?(stats.m_callbacks):(1);
+	double mean = stats.m_sum / count;
+	double variance = SDL_max(0.0, (stats.m_sum_sq / count) - (mean * mean));
+	Local<Object> result = Nan::New<Object>();
+	result->Set(NANX_SYMBOL("tid"), Nan::New((double) stats.m_tid));
+	result->Set(NANX_SYMBOL("callbacks"), Nan::New(stats.m_callbacks));
+	result->Set(NANX_SYMBOL("late"), Nan::New(stats.m_late));
+	result->Set(NANX_SYMBOL("periodMs"), Nan::New(stats.m_period * 1000.0));
+	result->Set(NANX_SYMBOL("meanJitterMs"), Nan::New(mean * 1000.0));
+	result->Set(NANX_SYMBOL("jitterMs"), Nan::New(sqrt(variance) * 1000.0));
+	result->Set(NANX_SYMBOL("maxJitterMs"), Nan::New(stats.m_max * 1000.0));
+	info.GetReturnValue().Set(result);
+}
+
+NANX_EXPORT(Mix_ResetAudioThreadStats)
+{
+	SDL_LockAudio();
+	_audio_thread_reset(false);
+	SDL_UnlockAudio();
+}
+
+// the playback clock as a SharedArrayBuffer; the same buffer is returned on
+// every call and stays valid across Mix_CloseAudio
+NANX_EXPORT(Mix_GetClockBuffer)
+{
+	static Nan::Persistent<SharedArrayBuffer> s_buffer;
+	if (s_buffer.IsEmpty())
+	{
+		s_buffer.Reset(SharedArrayBuffer::New(Isolate::GetCurrent(), &s_clock, sizeof(s_clock)));
+	}
+	info.GetReturnValue().Set(Nan::New<SharedArrayBuffer>(s_buffer));
+}
+
+// options { enabled, dither }; the engine takes plays started afterwards
+NANX_EXPORT(Mix_SetMixEngine)
+{
+	Local<Value> options = info[0];
+	SDL_LockAudio();
+	s_channel_engine = _option_bool(options, "enabled", true);
+	s_engine.m_dither = _option_bool(options, "dither", s_engine.m_dither);
+	SDL_UnlockAudio();
+}
+
+NANX_EXPORT(Mix_GetMixEngineStats)
+{
+	SDL_LockAudio();
+	MixEngineStats stats = s_engine;
+	bool enabled = s_channel_engine;
+	SDL_UnlockAudio();
+	Local<Object> result = Nan::New<Object>();
+	result->Set(NANX_SYMBOL("enabled"), Nan::New(enabled));
+	result->Set(NANX_SYMBOL("dither"), Nan::New(stats.m_dither));
+	result->Set(NANX_SYMBOL("voices"), Nan::New(stats.m_voices));
+	result->Set(NANX_SYMBOL("voicesPeak"), Nan::New(stats.m_voices_peak));
+	result->Set(NANX_SYMBOL("buffers"), Nan::New(stats.m_buffers));
+	info.GetReturnValue().Set(result);
+}
+
+// options { voices: [count, ...], frames, iterations }; mixes the same
+// synthetic AUDIO_S16SYS stereo voices the way SDL_mixer mixes plain
+// channels (SDL_MixAudioFormat straight from the chunk) and through the
+// engine kernels, without the audio device; returns
+// [{ voices, stockMs, engineMs, speedup }] with times per buffer
+NANX_EXPORT(Mix_BenchmarkMixEngine)
+{
+	Local<Value> options = info[0];
+	Local<Value> counts = _option(options, "voices");
+	int frames = SDL_max(64, SDL_min(_option_int(options, "frames", 1024), 16384));
+	int iterations = SDL_max(1, _option_int(options, "iterations", 100));
+	static const int k_default_counts[] = { 16, 32, 64, 128, 256 };
+	int count_list[16];
+	int count_size = 0;
+	if (counts->IsArray())
+	{
+		Local<Array> array = Local<Array>::Cast(counts);
+		for (uint32_t index = 0; (index < array->Length()) && (count_size < (int) countof(count_list)); ++index)
+		{
+			count_list[count_size++] = SDL_max(1, SDL_min(NANX_int(array->Get(index)), 1024));
+		}
+	}
+	else
+	{
+		for (int i = 0; i < (int) countof(k_default_counts); ++i) { count_list[count_size++] = k_default_counts[i]; }
+	}
+	int max_voices = 1;
+	for (int i = 0; i < count_size; ++i) { max_voices = SDL_max(max_voices, count_list[i]); }
+	const int channels = 2;
+	int samples = frames * channels;
+	int len = samples * (int) sizeof(Sint16);
+	Sint16* voices = (Sint16*) SDL_malloc(max_voices * len);
+	Sint16* stream = (Sint16*) SDL_malloc(len);
+	Uint32 seed = 0x9e3779b9;
+	for (int i = 0; i < max_voices * samples; ++i)
+	{
+		seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+		voices[i] = (Sint16) ((Sint32) (seed >> 16) - 32768) / 8;
+	}
+	double ticks = (double) SDL_GetPerformanceFrequency();
+	Local<Array> result = Nan::New<Array>();
+	for (int n = 0; n < count_size; ++n)
+	{
+		int voice_count = count_list[n];
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int it = 0; it < iterations; ++it)
+		{
+			SDL_memset(stream, 0, len);
+			for (int v = 0; v < voice_count; ++v)
+			{
+				SDL_MixAudioFormat((Uint8*) stream, (const Uint8*) (voices + (v * samples)), AUDIO_S16SYS, len, MIX_MAX_VOLUME / 2);
+			}
+		}
+		double stock = (double) (SDL_GetPerformanceCounter() - start) / ticks;
+		start = SDL_GetPerformanceCounter();
+		float bus[MIX_ENGINE_BLOCK_FRAMES * 2];
+		for (int it = 0; it < iterations; ++it)
+		{
+			SDL_memset(stream, 0, len);
+			for (int frame = 0; frame < frames; frame += MIX_ENGINE_BLOCK_FRAMES)
+			{
+				int count = SDL_min(MIX_ENGINE_BLOCK_FRAMES, frames - frame);
+				Uint8* data = (Uint8*) (stream + (frame * channels));
+				_pcm_to_float(data, bus, count * channels, AUDIO_S16SYS);
+				for (int v = 0; v < voice_count; ++v)
+				{
+					float g0[2] = { 0.5f, 0.5f - 0.25f * ((float) v / voice_count) };
+					float g1[2] = { 0.5f, 0.5f - 0.25f * ((float) v / voice_count) };
+					const Uint8* src = (const Uint8*) (voices + (v * samples) + (frame * channels));
+					_engine_voice_mix(src, AUDIO_S16SYS, channels, bus, count, g0, g1);
+				}
+				_engine_dither(bus, count * channels, 1.0f / 32768.0f, &seed);
+				_pcm_from_float(bus, data, count * channels, AUDIO_S16SYS);
+			}
+		}
+		double engine = (double) (SDL_GetPerformanceCounter() - start) / ticks;
+		Local<Object> row = Nan::New<Object>();
+		row->Set(NANX_SYMBOL("voices"), Nan::New(voice_count));
+		row->Set(NANX_SYMBOL("stockMs"), Nan::New(stock * 1000.0 / iterations));
+		row->Set(NANX_SYMBOL("engineMs"), Nan::New(engine * 1000.0 / iterations));
+		row->Set(NANX_SYMBOL("speedup"), Nan::New((engine > 0)?(stock / engine):(0.0)));
+		result->Set((uint32_t) n, row);
+	}
+	SDL_free(stream);
+	SDL_free(voices);
+	info.GetReturnValue().Set(result);
+}
+
+static int _adaptive_frames(int frames)
+{
+	int result = 64;
+	while ((result * 2) <= SDL_min(frames, 65536)) { result *= 2; }
+	return result;
+}
+
+// options { enabled, min: frames, max: frames, target: ms, window: seconds,
+// grow: late callbacks per window, stable: clean windows before shrinking };
+// callback(decision) gets { reason, from, to, latencyMs, late, callbacks, applied }
+// after every reopen, and once when the buffer is late at max until a window
+// passes without late callbacks.  A reopen
+// starts a new audio thread, which gets the Mix_SetAudioThreadOptions
+// options again.
+NANX_EXPORT(Mix_SetAdaptiveBuffer)
+{
+	Local<Value> options = info[0];
+	Local<Value> callback = info[1];
+	int min = _adaptive_frames(_option_int(options, "min", 256));
+	int max = SDL_max(_adaptive_frames(_option_int(options, "max", 8192)), min);
+	SDL_LockAudio();
+	s_adaptive.m_enabled = _option_bool(options, "enabled", true);
+	s_adaptive.m_min = min;
+	s_adaptive.m_max = max;
+	s_adaptive.m_target = SDL_max(_option_double(options, "target", 0.0), 0.0);
+	s_adaptive.m_window = SDL_max(_option_double(options, "window", 1.0), 0.1);
+	s_adaptive.m_grow = SDL_max(_option_int(options, "grow", 2), 1);
+	s_adaptive.m_stable = SDL_max(_option_int(options, "stable", 10), 1);
+	s_adaptive.m_clean = 0;
+	s_adaptive.m_limited = false;
+	_adaptive_reset();
+	SDL_UnlockAudio();
+	s_adaptive_callback.Reset();
+	if (!callback.IsEmpty() && callback->IsFunction()) { s_adaptive_callback.Reset(Local<Function>::Cast(callback)); }
+}
+
+NANX_EXPORT(Mix_GetAdaptiveBufferStats)
+{
+	int frequency = 0;
+	::Uint16 format = 0;
+	int channels = 0;
+	int frames = 0;
+	if (Mix_QuerySpec(&frequency, &format, &channels) > 0)
+	{
+		SDL_LockAudio();
+		frames = (int) s_clock.m_buffer_frames;
+		SDL_UnlockAudio();
+	}
+	Local<Object> result = Nan::New<Object>();
+	result->Set(NANX_SYMBOL("enabled"), Nan::New(s_adaptive.m_enabled));
+	result->Set(NANX_SYMBOL("frames"), Nan::New(frames));
+	result->Set(NANX_SYMBOL("latencyMs"), Nan::New((frequency > 0)?(frames * 1000.0 / frequency):(0.0)));
+	result->Set(NANX_SYMBOL("grows"), Nan::New(s_adaptive.m_grows));
+	result->Set(NANX_SYMBOL("shrinks"), Nan::New(s_adaptive.m_shrinks));
+	result->Set(NANX_SYMBOL("failures"), Nan::New(s_adaptive.m_failures));
+	result->Set(NANX_SYMBOL("decisions"), Nan::New(s_adaptive.m_decisions));
+	if (s_adaptive.m_decisions > 0) { result->Set(NANX_SYMBOL("last"), _adaptive_decision_object(s_adaptive.m_last)); }
+	info.GetReturnValue().Set(result);
 }
 
 NAN_MODULE_INIT(init)
 {
+	_audio_events_init();
+	#if defined(MIX_AVX2)
+	s_kernel_avx2 = (SDL_HasAVX2() == SDL_TRUE);
+	#endif
+
 	// SDL_mixer.h
 
 	NANX_CONSTANT(target, SDL_MIXER_MAJOR_VERSION);
@@ -771,6 +5838,9 @@ NAN_MODULE_INIT(init)
 	NANX_CONSTANT(target, MIX_DEFAULT_FORMAT);
 	NANX_CONSTANT(target, MIX_DEFAULT_CHANNELS);
 	NANX_CONSTANT(target, MIX_MAX_VOLUME);
+	NANX_CONSTANT(target, MIX_BUS_MUSIC);
+	NANX_CONSTANT(target, MIX_CLOCK_MAX_CHANNELS);
+	NANX_CONSTANT(target, MIX_MAX_SENDS);
 
 	// Mix_Fading
 	Local<Object> Fading = Nan::New<Object>();
@@ -793,6 +5863,44 @@ NAN_MODULE_INIT(init)
 	NANX_CONSTANT(MusicType, MUS_FLAC);
 	NANX_CONSTANT(MusicType, MUS_MODPLUG);
 
+	// Mix_EnvelopeParam
+	Local<Object> EnvelopeParam = Nan::New<Object>();
+	target->Set(NANX_SYMBOL("Mix_EnvelopeParam"), EnvelopeParam);
+	NANX_CONSTANT(EnvelopeParam, MIX_ENVELOPE_VOLUME);
+	NANX_CONSTANT(EnvelopeParam, MIX_ENVELOPE_PAN);
+
+	// Mix_EnvelopeCurve
+	Local<Object> EnvelopeCurve = Nan::New<Object>();
+	target->Set(NANX_SYMBOL("Mix_EnvelopeCurve"), EnvelopeCurve);
+	NANX_CONSTANT(EnvelopeCurve, MIX_CURVE_LINEAR);
+	NANX_CONSTANT(EnvelopeCurve, MIX_CURVE_EXPONENTIAL);
+	NANX_CONSTANT(EnvelopeCurve, MIX_CURVE_EQUAL_POWER);
+
+	// Mix_MusicStreamEvent
+	Local<Object> MusicStreamEvent = Nan::New<Object>();
+	target->Set(NANX_SYMBOL("Mix_MusicStreamEvent"), MusicStreamEvent);
+	NANX_CONSTANT(MusicStreamEvent, MIX_STREAM_NEED);
+	NANX_CONSTANT(MusicStreamEvent, MIX_STREAM_STARVE);
+	NANX_CONSTANT(MusicStreamEvent, MIX_STREAM_RESUME);
+
+	// Mix_ClockIndex
+	Local<Object> ClockIndex = Nan::New<Object>();
+	target->Set(NANX_SYMBOL("Mix_ClockIndex"), ClockIndex);
+	NANX_CONSTANT(ClockIndex, MIX_CLOCK_TIME);
+	NANX_CONSTANT(ClockIndex, MIX_CLOCK_FREQUENCY);
+	NANX_CONSTANT(ClockIndex, MIX_CLOCK_FRAMES);
+	NANX_CONSTANT(ClockIndex, MIX_CLOCK_BUFFER_FRAMES);
+	NANX_CONSTANT(ClockIndex, MIX_CLOCK_MUSIC_POSITION);
+	NANX_CONSTANT(ClockIndex, MIX_CLOCK_MUSIC_PLAYING);
+	NANX_CONSTANT(ClockIndex, MIX_CLOCK_CHANNEL_POSITION);
+
+	// Mix_AdaptiveReason
+	Local<Object> AdaptiveReason = Nan::New<Object>();
+	target->Set(NANX_SYMBOL("Mix_AdaptiveReason"), AdaptiveReason);
+	NANX_CONSTANT(AdaptiveReason, MIX_ADAPTIVE_UNDERRUN);
+	NANX_CONSTANT(AdaptiveReason, MIX_ADAPTIVE_TARGET);
+	NANX_CONSTANT(AdaptiveReason, MIX_ADAPTIVE_LIMIT);
+
 	NANX_CONSTANT_STRING(target, MIX_EFFECTSMAXSPEED);
 
 	NANX_EXPORT_APPLY(target, Mix_Init);
@@ -805,12 +5913,28 @@ NAN_MODULE_INIT(init)
 	NANX_EXPORT_APPLY(target, Mix_LoadWAV);
 	NANX_EXPORT_APPLY(target, Mix_LoadWAV_RW);
 	NANX_EXPORT_APPLY(target, Mix_LoadMUS);
+	NANX_EXPORT_APPLY(target, Mix_PrerollMusic);
+	NANX_EXPORT_APPLY(target, Mix_GetMusicPrefetchStats);
+	NANX_EXPORT_APPLY(target, Mix_CreateMusicStream);
+	NANX_EXPORT_APPLY(target, Mix_WriteMusicStream);
+	NANX_EXPORT_APPLY(target, Mix_EndMusicStream);
+	NANX_EXPORT_APPLY(target, Mix_GetMusicStreamStats);
+	NANX_EXPORT_APPLY(target, Mix_LoadMUS_Stream);
+	NANX_EXPORT_APPLY(target, Mix_GetLoadStats);
+	NANX_EXPORT_APPLY(target, Mix_ResetLoadStats);
 	NANX_EXPORT_APPLY(target, Mix_LoadMUS_RW);
 	NANX_EXPORT_APPLY(target, Mix_LoadMUSType_RW);
 	NANX_EXPORT_APPLY(target, Mix_QuickLoad_WAV);
 	NANX_EXPORT_APPLY(target, Mix_QuickLoad_RAW);
 	NANX_EXPORT_APPLY(target, Mix_FreeChunk);
 	NANX_EXPORT_APPLY(target, Mix_FreeMusic);
+	NANX_EXPORT_APPLY(target, Mix_GetChunkLength);
+	NANX_EXPORT_APPLY(target, Mix_GetChunkDuration);
+	NANX_EXPORT_APPLY(target, Mix_GetChunkBuffer);
+	NANX_EXPORT_APPLY(target, Mix_GetChunkAnalysis);
+	NANX_EXPORT_APPLY(target, Mix_CreateArena);
+	NANX_EXPORT_APPLY(target, Mix_ReleaseArena);
+	NANX_EXPORT_APPLY(target, Mix_GetArenaStats);
 	NANX_EXPORT_APPLY(target, Mix_GetNumChunkDecoders);
 	NANX_EXPORT_APPLY(target, Mix_GetChunkDecoder);
 	NANX_EXPORT_APPLY(target, Mix_GetNumMusicDecoders);
@@ -845,6 +5969,18 @@ NAN_MODULE_INIT(init)
 	NANX_EXPORT_APPLY(target, Mix_Volume);
 	NANX_EXPORT_APPLY(target, Mix_VolumeChunk);
 	NANX_EXPORT_APPLY(target, Mix_VolumeMusic);
+	NANX_EXPORT_APPLY(target, Mix_SetPlaybackRate);
+	NANX_EXPORT_APPLY(target, Mix_GetPlaybackRate);
+	NANX_EXPORT_APPLY(target, Mix_SetBusGain);
+	NANX_EXPORT_APPLY(target, Mix_GetBusGain);
+	NANX_EXPORT_APPLY(target, Mix_AddDuckRule);
+	NANX_EXPORT_APPLY(target, Mix_RemoveDuckRule);
+	NANX_EXPORT_APPLY(target, Mix_SetReverb);
+	NANX_EXPORT_APPLY(target, Mix_SetChannelSend);
+	NANX_EXPORT_APPLY(target, Mix_GetChannelSend);
+	NANX_EXPORT_APPLY(target, Mix_GetReverbStats);
+	NANX_EXPORT_APPLY(target, Mix_SetEnvelope);
+	NANX_EXPORT_APPLY(target, Mix_ClearEnvelope);
 	NANX_EXPORT_APPLY(target, Mix_HaltChannel);
 	NANX_EXPORT_APPLY(target, Mix_HaltGroup);
 	NANX_EXPORT_APPLY(target, Mix_HaltMusic);
@@ -862,6 +5998,7 @@ NAN_MODULE_INIT(init)
 	NANX_EXPORT_APPLY(target, Mix_RewindMusic);
 	NANX_EXPORT_APPLY(target, Mix_PausedMusic);
 	NANX_EXPORT_APPLY(target, Mix_SetMusicPosition);
+	NANX_EXPORT_APPLY(target, Mix_SetMusicLength);
 	NANX_EXPORT_APPLY(target, Mix_Playing);
 	NANX_EXPORT_APPLY(target, Mix_PlayingMusic);
 	NANX_EXPORT_APPLY(target, Mix_SetMusicCMD);
@@ -872,6 +6009,15 @@ NAN_MODULE_INIT(init)
 	NANX_EXPORT_APPLY(target, Mix_EachSoundFont);
 	NANX_EXPORT_APPLY(target, Mix_GetChunk);
 	NANX_EXPORT_APPLY(target, Mix_CloseAudio);
+	NANX_EXPORT_APPLY(target, Mix_SetAudioThreadOptions);
+	NANX_EXPORT_APPLY(target, Mix_GetAudioThreadStats);
+	NANX_EXPORT_APPLY(target, Mix_ResetAudioThreadStats);
+	NANX_EXPORT_APPLY(target, Mix_GetClockBuffer);
+	NANX_EXPORT_APPLY(target, Mix_SetAdaptiveBuffer);
+	NANX_EXPORT_APPLY(target, Mix_SetMixEngine);
+	NANX_EXPORT_APPLY(target, Mix_GetMixEngineStats);
+	NANX_EXPORT_APPLY(target, Mix_BenchmarkMixEngine);
+	NANX_EXPORT_APPLY(target, Mix_GetAdaptiveBufferStats);
 }
 
 } // namespace node_sdl2_mixer
@@ -32,6 +32,8 @@
 #include <SDL.h>
 #include <SDL_mixer.h>
 
+#include <math.h> // HUGE_VAL
+
 #include "node-sdl2.h"
 
 namespace node_sdl2_mixer {
@@ -85,36 +87,143 @@ private:
 	}
 };
 
+// load-time analysis of Mix_Chunk PCM
+
+class MixChunkAnalysis
+{
+public:
+	double m_peak; // linear full scale
+	double m_rms;
+	double m_loudness; // LUFS, integrated and gated
+	double m_duration; // ms
+	double m_leading_silence; // ms
+	double m_trailing_silence; // ms
+	int m_envelope_size; // min/max pairs
+	float* m_envelope;
+public:
+	MixChunkAnalysis() :
+		m_peak(0), m_rms(0), m_loudness(-HUGE_VAL), m_duration(0),
+		m_leading_silence(0), m_trailing_silence(0),
+		m_envelope_size(0), m_envelope(NULL) {}
+	~MixChunkAnalysis() { delete[] m_envelope; m_envelope = NULL; }
+};
+
+// scene arena for chunk PCM; slabs are freed together by Clear, which drops
+// the chunk of every wrap in the arena
+
+class WrapChunk;
+
+class MixArena
+{
+public:
+	struct Slab { Slab* m_next; size_t m_size; size_t m_used; };
+public:
+	SDL_mutex* m_mutex; // Place runs on load worker threads
+	int m_refs; // handle, member wraps and pending loads; main thread only
+	Uint32 m_generation; // bumped by Clear
+	size_t m_slab_size;
+	Slab* m_slabs; // newest shared slab first; chunks go to the tightest free tail
+	WrapChunk* m_wraps;
+	int m_chunks;
+	size_t m_live; // bytes of chunks still held by wraps
+public:
+	MixArena(size_t slab_size);
+	~MixArena();
+public:
+	void Retain() { ++m_refs; }
+	void Release() { if (--m_refs == 0) { delete this; } }
+	bool Place(Mix_Chunk* chunk, Uint32* generation);
+	void Adopt(WrapChunk* wrap);
+	void Forget(WrapChunk* wrap);
+	void Clear();
+	size_t Reserved();
+	size_t Used();
+};
+
 // wrap Mix_Chunk pointer
 
 class WrapChunk : public Nan::ObjectWrap
 {
+	friend class MixArena;
 private:
 	Mix_Chunk* m_chunk;
+	MixChunkAnalysis* m_analysis;
+	Nan::Persistent<v8::ArrayBuffer> m_buffer; // weak, aliases m_chunk->abuf
+	MixArena* m_arena; // set while m_chunk->abuf lives in an arena slab
+	size_t m_arena_size;
+	WrapChunk* m_arena_prev;
+	WrapChunk* m_arena_next;
+	bool m_locked; // PCM held in RAM with mlock
+	WrapChunk* m_prev; // s_wraps, main thread only
+	WrapChunk* m_next;
+	static WrapChunk* s_wraps;
+	static bool s_lock_pcm; // lock the PCM of every wrap
 public:
-	WrapChunk(Mix_Chunk* chunk) : m_chunk(chunk) {}
-	~WrapChunk() { Free(m_chunk); m_chunk = NULL; }
+	WrapChunk(Mix_Chunk* chunk, MixChunkAnalysis* analysis = NULL) :
+		m_chunk(chunk), m_analysis(analysis),
+		m_arena(NULL), m_arena_size(0), m_arena_prev(NULL), m_arena_next(NULL),
+		m_locked(false), m_prev(NULL), m_next(NULL) { Link(); }
+	~WrapChunk() { m_buffer.Reset(); Unlink(); Free(m_chunk); m_chunk = NULL; LeaveArena(); delete m_analysis; m_analysis = NULL; }
 public:
 	Mix_Chunk* Peek() { return m_chunk; }
-	Mix_Chunk* Drop() { Mix_Chunk* chunk = m_chunk; m_chunk = NULL; return chunk; }
+	MixChunkAnalysis* Analysis() { return (m_chunk)?(m_analysis):(NULL); }
+	Mix_Chunk* Drop() { Neuter(); Lock(false); Mix_Chunk* chunk = m_chunk; m_chunk = NULL; return chunk; }
+	int Lock(bool lock);
+	static size_t LockAll(bool lock, int* error);
+private:
+	void Link();
+	void Unlink();
+public:
+	// only once the chunk is freed, so no channel still reads the slab
+	void LeaveArena() { if (m_arena) { m_arena->Forget(this); } }
+public:
+	// external ArrayBuffer over the chunk PCM; the buffer keeps this wrap alive
+	// and is neutered when the chunk is dropped
+	v8::Local<v8::Value> Buffer()
+	{
+		Nan::EscapableHandleScope scope;
+		if (!m_chunk || !m_chunk->abuf) { return scope.Escape(Nan::Null()); }
+		if (m_buffer.IsEmpty())
+		{
+			v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(v8::Isolate::GetCurrent(), m_chunk->abuf, m_chunk->alen);
+			Nan::SetPrivate(buffer, Nan::New("WrapChunk").ToLocalChecked(), handle());
+			m_buffer.Reset(buffer);
+			m_buffer.SetWeak(this, _buffer_weak, Nan::WeakCallbackType::kParameter);
+		}
+		v8::Local<v8::ArrayBuffer> buffer = Nan::New<v8::ArrayBuffer>(m_buffer);
+		return scope.Escape(buffer);
+	}
+	void Neuter()
+	{
+		if (!m_buffer.IsEmpty())
+		{
+			Nan::HandleScope scope;
+			v8::Local<v8::ArrayBuffer> buffer = Nan::New<v8::ArrayBuffer>(m_buffer);
+			buffer->Neuter();
+			m_buffer.Reset();
+		}
+	}
+private:
+	static void _buffer_weak(const Nan::WeakCallbackInfo<WrapChunk>& data)
+	{
+		data.GetParameter()->m_buffer.Reset();
+	}
 public:
 	static WrapChunk* Unwrap(v8::Local<v8::Value> value) { return (value->IsObject())?(Unwrap(v8::Local<v8::Object>::Cast(value))):(NULL); }
 	static WrapChunk* Unwrap(v8::Local<v8::Object> object) { return Nan::ObjectWrap::Unwrap<WrapChunk>(object); }
 	static Mix_Chunk* Peek(v8::Local<v8::Value> value) { WrapChunk* wrap = Unwrap(value); return (wrap)?(wrap->Peek()):(NULL); }
 public:
-	static v8::Local<v8::Value> Hold(Mix_Chunk* chunk) { return NewInstance(chunk); }
+	static v8::Local<v8::Value> Hold(Mix_Chunk* chunk, MixChunkAnalysis* analysis = NULL) { return NewInstance(chunk, analysis); }
 	static Mix_Chunk* Drop(v8::Local<v8::Value> value) { WrapChunk* wrap = Unwrap(value); return (wrap)?(wrap->Drop()):(NULL); }
-	static void Free(Mix_Chunk* chunk)
-	{
-		if (chunk) { Mix_FreeChunk(chunk); chunk = NULL; }
-	}
+	// also halts float mix engine voices playing the chunk
+	static void Free(Mix_Chunk* chunk);
 public:
-	static v8::Local<v8::Object> NewInstance(Mix_Chunk* chunk)
+	static v8::Local<v8::Object> NewInstance(Mix_Chunk* chunk, MixChunkAnalysis* analysis = NULL)
 	{
 		Nan::EscapableHandleScope scope;
 		v8::Local<v8::ObjectTemplate> object_template = GetObjectTemplate();
 		v8::Local<v8::Object> instance = object_template->NewInstance();
-		WrapChunk* wrap = new WrapChunk(chunk);
+		WrapChunk* wrap = new WrapChunk(chunk, analysis);
 		wrap->Wrap(instance);
 		return scope.Escape(instance);
 	}
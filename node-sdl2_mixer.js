@@ -47,6 +47,127 @@ node_sdl2_mixer.Mix_CheckError = node_sdl2_mixer.Mix_CheckError || function() {
   return error;
 };
 
+/// var clock = sdl_mixer.ReadClock(clock);
+/// clock.musicPosition + (Number(process.hrtime.bigint()) / 1e6 - clock.time) / 1000
+node_sdl2_mixer.Mix_ReadClock = node_sdl2_mixer.Mix_ReadClock || (function() {
+  var buffer = null, sequence = null, values = null;
+  return function(out) {
+    out = out || {};
+    if (!buffer) {
+      buffer = node_sdl2_mixer.Mix_GetClockBuffer();
+      sequence = new Int32Array(buffer, 0, 2);
+      values = new Float64Array(buffer);
+    }
+    var index = node_sdl2_mixer.Mix_ClockIndex;
+    var channels = out.channels || [];
+    var consistent = false;
+    // the audio thread holds the sequence odd only while it writes, so a few
+    // retries do; past that the last read is returned with consistent false
+    for (var tries = 0; !consistent && (tries < 1000); ++tries) {
+      var before = Atomics.load(sequence, 0);
+      if (before & 1) { continue; }
+      var count = sequence[1];
+      out.time = values[index.MIX_CLOCK_TIME];
+      out.frequency = values[index.MIX_CLOCK_FREQUENCY];
+      out.frames = values[index.MIX_CLOCK_FRAMES];
+      out.bufferFrames = values[index.MIX_CLOCK_BUFFER_FRAMES];
+      out.musicPosition = values[index.MIX_CLOCK_MUSIC_POSITION];
+      out.musicPlaying = values[index.MIX_CLOCK_MUSIC_PLAYING] !== 0;
+      channels.length = count;
+      for (var i = 0; i < count; ++i) {
+        channels[i] = values[index.MIX_CLOCK_CHANNEL_POSITION + i];
+      }
+      consistent = Atomics.load(sequence, 0) === before;
+    }
+    out.consistent = consistent;
+    out.channels = channels;
+    return out;
+  };
+})();
+
+/// var writable = sdl_mixer.CreateMusicWritable({ capacity: 256 * 1024 });
+/// socket.pipe(writable);
+/// sdl_mixer.LoadMUS_Stream(writable.stream, function (music) { sdl_mixer.PlayMusic(music, 0); });
+node_sdl2_mixer.Mix_CreateMusicWritable = node_sdl2_mixer.Mix_CreateMusicWritable || function(options) {
+  var Writable = require('stream').Writable;
+  var events = node_sdl2_mixer.Mix_MusicStreamEvent;
+  var pending = null; // { chunk, callback } waiting for room in the ring
+  var writable = new Writable({
+    write: function(chunk, encoding, callback) {
+      pending = { chunk: chunk, callback: callback };
+      pump();
+    }
+  });
+  function pump() {
+    if (!pending) { return; }
+    var accepted = node_sdl2_mixer.Mix_WriteMusicStream(writable.stream, pending.chunk);
+    if (accepted < pending.chunk.length) {
+      pending.chunk = pending.chunk.subarray(accepted);
+      return; // wait for MIX_STREAM_NEED
+    }
+    var callback = pending.callback;
+    pending = null;
+    callback();
+  }
+  writable.stream = node_sdl2_mixer.Mix_CreateMusicStream(options, function(event) {
+    switch (event) {
+      case events.MIX_STREAM_NEED: pump(); writable.emit('need'); break;
+      case events.MIX_STREAM_STARVE: writable.emit('starve'); break;
+      case events.MIX_STREAM_RESUME: writable.emit('resume'); break;
+    }
+  });
+  writable.on('finish', function() {
+    node_sdl2_mixer.Mix_EndMusicStream(writable.stream);
+  });
+  return writable;
+};
+
+/// sdl_mixer.TraceLoads(true);
+/// node --trace-event-categories node.perf.usertiming game.js
+/// loads become performance measures "Mix_LoadWAV <file>" with queue, open,
+/// read, decode and process spans; Node writes them to the trace log
+/// returns false where performance.measure takes no options (before Node 16)
+node_sdl2_mixer.Mix_TraceLoads = node_sdl2_mixer.Mix_TraceLoads || (function() {
+  var performance = null;
+  try {
+    var perf_hooks = require('perf_hooks');
+    // measure options came with the Level 3 marks
+    if (perf_hooks.PerformanceMark) { performance = perf_hooks.performance; }
+  } catch (err) {}
+  var tracing = false;
+  var phases = [ "queue", "open", "read", "decode", "process" ];
+  function measure(name, start, duration, detail) {
+    performance.measure(name, { start: start, duration: duration, detail: detail });
+  }
+  function trace(key) {
+    var load = node_sdl2_mixer[key];
+    node_sdl2_mixer[key] = function(source, callback, options) {
+      if (!tracing) { return load(source, callback, options); }
+      var start = performance.now();
+      var stats = options && options.stats;
+      return load(source, function(asset, trace) {
+        var name = key + " " + trace.file;
+        measure(name, start, trace.totalMs, trace);
+        var at = start;
+        phases.forEach(function(phase) {
+          var duration = trace[phase + "Ms"];
+          if (duration > 0) { measure(name + " " + phase, at, duration); }
+          at += duration;
+        });
+        return stats ? callback(asset, trace) : callback(asset);
+      }, Object.assign({}, options, { stats: true }));
+    };
+  }
+  trace("Mix_LoadWAV");
+  trace("Mix_LoadWAV_RW");
+  trace("Mix_LoadMUS");
+  trace("Mix_LoadMUS_Stream");
+  return function(enable) {
+    tracing = !!enable && !!performance;
+    return tracing;
+  };
+})();
+
 /// var node_sdl2_mixer = require('@flyover/node-sdl2_mixer');
 /// var sdl_mixer = node_sdl2_mixer.Mix();
 /// node_sdl2_mixer.Mix_* -> sdl_mixer.*